@@ -0,0 +1,285 @@
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_board.hpp"
+
+using namespace pyl;
+
+/*
+ * Accuracy versus speed harness.
+ *
+ * A fixed corpus of states is solved under a high fidelity reference
+ * configuration and under a faster candidate configuration.  For each
+ * state, the decisions, payoffs and solve times are compared.
+ *
+ * Usage: accuracy [-f board] [-s] [-l max_lead] [-u max_uncertainty] [-r file] [-w file]
+ *   -f board read the board from a text board file rather than using the
+ *            February 1985 board; its powers are kept in a cache file in
+ *            the current directory
+ *   -s       candidate uses the spread (lossy) board
+ *   -l, -u   candidate search options
+ *   -w file  save the reference results
+ *   -r file  load reference results instead of solving them; use this
+ *            to compare builds, e.g. a reference built with SCORE_UNIT=50
+ *
+ * The exit status is nonzero if any decision differs.
+ */
+
+const State corpus[] = {
+	State{ {{0}, { 2000, 3}, { 3500, 2 }} },
+	State{ {{2000}, { 3000, 3}, { 6000 }} },
+	State{ {{0}, { 10000, 2}, { 7000, 1 }} },
+	State{ {{0}, { 10000, 1}, { 7000, 0 }} },
+	State{ {{0}, { 4000, 1}, { 6000, 0 }} },
+	State{ {{0}, { 5500, 1}, { 6000, 0 }} },
+	State{ {{0}, { 6000, 1}, { 6000, 0 }} },
+	State{ {{0}, { 6500, 1}, { 6000, 0 }} },
+	State{ {{0}, { 8000, 1}, { 6000, 0 }} },
+	State{ {{0}, { 8000, 1}, { 3000, 0 }} },
+	State{ {{0}, { 8000, 2}, { 3000, 0 }} },
+	State{ {{0}, { 8000, 3}, { 3000, 0 }} },
+};
+constexpr size_t corpus_size = sizeof(corpus) / sizeof(corpus[0]);
+
+struct Config
+{
+	SpinPowers powers;
+	SearchOptions options;
+};
+
+struct Outcome
+{
+	DecideNode::Decision decision = DecideNode::UNDECIDED;
+	Payoff play;
+	Payoff pass;
+	double seconds = 0.0;
+	size_t nodes = 0;
+};
+
+const char *decision_name (DecideNode::Decision decision)
+{
+	switch (decision)
+	{
+		case DecideNode::PLAY: return "play";
+		case DecideNode::PASS: return "pass";
+		default: return "undecided";
+	}
+}
+
+Outcome solve (const Config& config, const State& state)
+{
+	/* Each state gets its own Search, so that timings do not depend on
+	what earlier states left in the cache. */
+	Search search (config.powers, config.options);
+	Outcome res;
+
+	auto start = std::chrono::steady_clock::now ();
+	DecideNode *node = search.run (state);
+	res.decision = node->decision ();
+	if (node->if_play)
+		res.play = node->if_play->payoff ();
+	if (node->if_pass)
+		res.pass = node->if_pass->payoff ();
+	res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now () - start).count ();
+	res.nodes = search.node_cache_->size ();
+	return res;
+}
+
+void write_outcome (ostream& os, size_t n, const Outcome& o)
+{
+	os << n << ' ' << int(o.decision);
+	for (size_t i = 0; i < num_players; ++i)
+		os << ' ' << (o.play ? o.play[i] : Payoff::null_value);
+	for (size_t i = 0; i < num_players; ++i)
+		os << ' ' << (o.pass ? o.pass[i] : Payoff::null_value);
+	os << ' ' << o.seconds << ' ' << o.nodes << '\n';
+}
+
+bool read_outcome (istream& is, size_t& n, Outcome& o)
+{
+	int decision;
+	Prob p;
+	if (!(is >> n >> decision))
+		return false;
+	o.decision = DecideNode::Decision(decision);
+	o.play.clear ();
+	for (size_t i = 0; i < num_players; ++i)
+		if (is >> p)
+			o.play.assign (i, p);
+	o.pass.clear ();
+	for (size_t i = 0; i < num_players; ++i)
+		if (is >> p)
+			o.pass.assign (i, p);
+	if (o.play[0] < 0)
+		o.play.invalidate ();
+	if (o.pass[0] < 0)
+		o.pass.invalidate ();
+	return bool(is >> o.seconds >> o.nodes);
+}
+
+/* Largest difference in any player's win probability between two payoffs
+for the same choice.  The two searches may stop at different uncertainty,
+so the midpoints of the win ranges are compared rather than the lower
+bounds.  A choice that exists in only one of them counts as 1. */
+Prob payoff_delta (const Payoff& p1, const Payoff& p2)
+{
+	if (!p1 && !p2)
+		return 0.0;
+	if (!p1 || !p2)
+		return 1.0;
+	Prob res = 0.0;
+	for (size_t i = 0; i < num_players; ++i)
+	{
+		Prob mid1 = p1[i] + p1.uncertainty () / 2;
+		Prob mid2 = p2[i] + p2.uncertainty () / 2;
+		res = std::max (res, std::abs (mid1 - mid2));
+	}
+	return res;
+}
+
+int main (int argc, char *argv[])
+{
+	Config reference;
+	reference.options.max_uncertainty = 0.005;
+	reference.options.max_lead = 0; /* never cut off play */
+
+	Config candidate;
+
+	const char *board_path = nullptr;
+	bool spread = false;
+	const char *read_path = nullptr;
+	const char *write_path = nullptr;
+	int opt;
+	while ((opt = getopt (argc, argv, "f:sl:u:r:w:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f': board_path = optarg; break;
+			case 's': spread = true; break;
+			case 'l': candidate.options.max_lead = atoi (optarg); break;
+			case 'u': candidate.options.max_uncertainty = atof (optarg); break;
+			case 'r': read_path = optarg; break;
+			case 'w': write_path = optarg; break;
+			default:
+				cerr << "usage: " << argv[0] << " [-f board] [-s] [-l max_lead] [-u max_uncertainty] [-r file] [-w file]\n";
+				return 2;
+		}
+	}
+
+	SpinOperator board = SpinFeb85 ();
+	if (board_path)
+	{
+		TextBoard text;
+		if (!text.load (board_path))
+			return 2;
+		board = text;
+		reference.powers.cached (board, ".");
+		candidate.powers.cached (spread ? board.spread () : board, ".");
+	}
+	else
+	{
+		reference.powers.compute (board);
+		candidate.powers.compute (spread ? board.spread () : board);
+	}
+
+	/* The search reports its progress on clog; silence it so that only
+	the comparison is printed. */
+	std::ostringstream chatter;
+	std::streambuf *clog_buf = clog.rdbuf (chatter.rdbuf ());
+
+	Outcome ref[corpus_size];
+	if (read_path)
+	{
+		std::ifstream is (read_path);
+		if (!is)
+		{
+			cerr << argv[0] << ": cannot open " << read_path << '\n';
+			return 2;
+		}
+		bool seen[corpus_size] = {};
+		size_t count = 0;
+		size_t n;
+		Outcome o;
+		while (read_outcome (is, n, o))
+		{
+			if (n >= corpus_size || seen[n])
+			{
+				cerr << argv[0] << ": " << read_path << ": unexpected outcome " << n << '\n';
+				return 2;
+			}
+			seen[n] = true;
+			ref[n] = o;
+			++count;
+		}
+		if (count != corpus_size)
+		{
+			cerr << argv[0] << ": " << read_path << ": " << count << " outcomes, expected " << corpus_size << '\n';
+			return 2;
+		}
+	}
+	else
+	{
+		for (size_t n = 0; n < corpus_size; ++n)
+		{
+			ref[n] = solve (reference, corpus[n]);
+			chatter.str ("");
+		}
+	}
+
+	if (write_path)
+	{
+		std::ofstream os (write_path);
+		for (size_t n = 0; n < corpus_size; ++n)
+			write_outcome (os, n, ref[n]);
+	}
+
+	unsigned int disagreements = 0;
+	Prob max_delta = 0.0;
+	Prob sum_delta = 0.0;
+	double ref_seconds = 0.0;
+	double cand_seconds = 0.0;
+
+	cout.setf (ios::fixed, ios::floatfield);
+	for (size_t n = 0; n < corpus_size; ++n)
+	{
+		Outcome cand = solve (candidate, corpus[n]);
+		chatter.str ("");
+
+		Prob delta = std::max (payoff_delta (ref[n].play, cand.play),
+			payoff_delta (ref[n].pass, cand.pass));
+		bool differs = (ref[n].decision != cand.decision);
+		disagreements += differs;
+		max_delta = std::max (max_delta, delta);
+		sum_delta += delta;
+		ref_seconds += ref[n].seconds;
+		cand_seconds += cand.seconds;
+
+		State root = corpus[n];
+		root.change_player ();
+		cout << std::setw(2) << n << ' ' << root <<
+			' ' << decision_name (ref[n].decision) << '/' << decision_name (cand.decision) <<
+			(differs ? " DIFFER" : "") <<
+			std::setprecision(3) << " delta " << delta <<
+			std::setprecision(2) << " time " << ref[n].seconds << '/' << cand.seconds <<
+			" nodes " << ref[n].nodes << '/' << cand.nodes << '\n';
+	}
+
+	clog.rdbuf (clog_buf);
+
+	cout << "disagreements: " << disagreements << " of " << corpus_size << '\n';
+	cout << std::setprecision(4) << "payoff delta: max " << max_delta <<
+		", mean " << sum_delta / corpus_size << '\n';
+	cout << std::setprecision(2) << "speedup: " <<
+		(cand_seconds > 0.0 ? ref_seconds / cand_seconds : 0.0) << "x (" <<
+		ref_seconds << "s / " << cand_seconds << "s)\n";
+	return disagreements ? 1 : 0;
+}
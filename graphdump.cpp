@@ -0,0 +1,118 @@
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_graph.hpp"
+
+using namespace pyl;
+
+/*
+ * Export and inspect searched graphs.
+ *
+ * Usage: graphdump -w file [-g dot-file] [-d depth] [-p prob] [-s spins]
+ *        graphdump file
+ *   -w file      solve a sample state and write its graph to file
+ *   -g dot-file  also write the graph near the root in DOT format,
+ *                cut off at depth -d (default 4) and path probability
+ *                -p (default 0.01)
+ *   -s spins     spins of the player up in the sample state (default 3)
+ *
+ * Given only a file, the graph is loaded and summarized.
+ */
+
+int summarize (const char *path)
+{
+	GraphFile graph;
+	if (!graph.open (path))
+		return 1;
+
+	uint64_t count[3] = {};
+	uint64_t solved = 0, dangling = 0;
+	for (uint64_t n = 0; n < graph.size (); ++n)
+	{
+		const GraphNodeRecord& r = graph.nodes ()[n];
+		count[r.kind < 3 ? r.kind : 0]++;
+		solved += r.has_payoff;
+		for (uint64_t e = graph.offsets ()[n]; e < graph.offsets ()[n + 1]; ++e)
+			dangling += (graph.edges ()[e].target == GraphNoNode);
+	}
+
+	cout << path << ": " << graph.size () << " nodes (" << count[GRAPH_SPIN] << " spin, " <<
+		count[GRAPH_DECIDE] << " decide, " << count[GRAPH_TERMINAL] << " terminal), " <<
+		graph.header ().edge_count << " edges, " << solved << " with payoff, " <<
+		dangling << " missing choices\n";
+	if (graph.header ().root != GraphNoNode)
+	{
+		const GraphNodeRecord& r = graph.nodes ()[graph.header ().root];
+		cout << "root " << graph.state (graph.header ().root);
+		if (r.has_payoff)
+			cout << " (" << r.payoff[0] << ' ' << r.payoff[1] << ' ' << r.payoff[2] << ')';
+		cout << '\n';
+	}
+	return 0;
+}
+
+int main (int argc, char *argv[])
+{
+	const char *write_path = nullptr;
+	const char *dot_path = nullptr;
+	int depth = 4;
+	Prob prob = 0.01;
+	unsigned int spins = 3;
+	int opt;
+	while ((opt = getopt (argc, argv, "w:g:d:p:s:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'w': write_path = optarg; break;
+			case 'g': dot_path = optarg; break;
+			case 'd': depth = atoi (optarg); break;
+			case 'p': prob = atof (optarg); break;
+			case 's': spins = atoi (optarg); break;
+			default:
+				cerr << "usage: " << argv[0] << " -w file [-g dot-file] [-d depth] [-p prob] [-s spins]\n";
+				cerr << "       " << argv[0] << " file\n";
+				return 2;
+		}
+	}
+
+	if (!write_path)
+	{
+		if (optind >= argc)
+		{
+			cerr << "usage: " << argv[0] << " file\n";
+			return 2;
+		}
+		return summarize (argv[optind]);
+	}
+
+	/* Silence the search's progress report */
+	std::ostringstream chatter;
+	std::streambuf *clog_buf = clog.rdbuf (chatter.rdbuf ());
+
+	SpinFeb85 board;
+	Search search (board, SearchOptions());
+	State init{ {{0}, { 8000, spins}, { 3000, 0 }} };
+	DecideNode *root = search.run (init);
+	clog.rdbuf (clog_buf);
+
+	std::ofstream os (write_path, std::ios::binary);
+	if (!write_graph (os, search, root))
+	{
+		cerr << write_path << ": write failed\n";
+		return 1;
+	}
+	os.close ();
+
+	if (dot_path)
+	{
+		std::ofstream dot (dot_path);
+		write_dot (dot, root, depth, prob);
+	}
+	return summarize (write_path);
+}
@@ -0,0 +1,225 @@
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+
+using namespace pyl;
+
+/*
+ * Performance regression runner.
+ *
+ * Each scenario is solved several times with a fresh Search.  The median
+ * and standard deviation of the wall time are recorded, along with the
+ * node count, the peak memory and the decision, which do not vary between
+ * repetitions.
+ *
+ * Usage: perfrun [-n repetitions] [-t tolerance] [-b] [-c order] [-w] baseline-file
+ *   -w   record a new baseline instead of comparing against it
+ *   -t   relative slowdown that is always tolerated (default 0.15)
+ *   -b   scan breadth first (SearchOptions::breadth_first)
+ *   -c   compact the nodes after each iteration, 1 in preorder and 2 in
+ *        postorder (SearchOptions::compact)
+ *
+ * When comparing, a scenario is flagged if its time is worse than the
+ * baseline by more than both the tolerance and three standard errors, if
+ * its node count or peak memory grew, or if its decision changed.  The
+ * exit status is nonzero if anything was flagged.
+ */
+
+struct Scenario
+{
+	const char *name;
+	State state;
+};
+
+const Scenario scenarios[] = {
+	{ "three-player", State{ {{2000}, { 3000, 3}, { 6000 }} } },
+	{ "leader-two-spins", State{ {{0}, { 10000, 2}, { 7000, 1 }} } },
+	{ "leader-one-spin", State{ {{0}, { 10000, 1}, { 7000, 0 }} } },
+	{ "final-spin-behind", State{ {{0}, { 4000, 1}, { 6000, 0 }} } },
+	{ "final-spin-ahead", State{ {{0}, { 8000, 1}, { 3000, 0 }} } },
+	{ "big-lead-two-spins", State{ {{0}, { 8000, 2}, { 3000, 0 }} } },
+	{ "big-lead-three-spins", State{ {{0}, { 8000, 3}, { 3000, 0 }} } },
+};
+
+struct Measurement
+{
+	std::string name;
+	unsigned int samples = 0;
+	double median = 0.0;
+	double stddev = 0.0;
+	size_t nodes = 0;
+	size_t peak_bytes = 0;
+	int decision = DecideNode::UNDECIDED;
+};
+
+Measurement measure (const SpinOperator& board, const SearchOptions& options, const Scenario& scenario,
+	unsigned int reps)
+{
+	Measurement res;
+	res.name = scenario.name;
+	res.samples = reps;
+
+	std::vector<double> times;
+	for (unsigned int r = 0; r < reps; ++r)
+	{
+		Search search (board, options);
+		auto start = std::chrono::steady_clock::now ();
+		DecideNode *node = search.run (scenario.state);
+		times.push_back (std::chrono::duration<double>(std::chrono::steady_clock::now () - start).count ());
+		res.nodes = search.node_cache_->size ();
+		res.peak_bytes = MemoryStats::peak_bytes;
+		res.decision = node->decision ();
+	}
+
+	std::sort (times.begin (), times.end ());
+	res.median = (reps % 2) ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2;
+	double mean = std::accumulate (times.begin (), times.end (), 0.0) / reps;
+	double var = 0.0;
+	for (double t : times)
+		var += (t - mean) * (t - mean);
+	res.stddev = (reps > 1) ? std::sqrt (var / (reps - 1)) : 0.0;
+	return res;
+}
+
+ostream& operator<< (ostream& os, const Measurement& m)
+{
+	os << m.name << ' ' << m.samples << ' ' << m.median << ' ' << m.stddev << ' ' <<
+		m.nodes << ' ' << m.peak_bytes << ' ' << m.decision;
+	return os;
+}
+
+istream& operator>> (istream& is, Measurement& m)
+{
+	is >> m.name >> m.samples >> m.median >> m.stddev >> m.nodes >> m.peak_bytes >> m.decision;
+	return is;
+}
+
+/* Compare against the baseline and return a (possibly empty) list of
+the ways in which the scenario regressed. */
+std::string compare (const Measurement& base, const Measurement& m, double tolerance)
+{
+	std::string res;
+	double std_error = std::sqrt (base.stddev * base.stddev / std::max (base.samples, 1u) +
+		m.stddev * m.stddev / std::max (m.samples, 1u));
+	double slower = m.median - base.median;
+	if (slower > tolerance * base.median && slower > 3 * std_error)
+		res += " TIME";
+	if (m.nodes > base.nodes)
+		res += " NODES";
+	if (m.peak_bytes > base.peak_bytes)
+		res += " MEMORY";
+	if (m.decision != base.decision)
+		res += " RESULT";
+	return res;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int reps = 5;
+	double tolerance = 0.15;
+	bool record = false;
+	SearchOptions options;
+	int opt;
+	while ((opt = getopt (argc, argv, "n:t:bc:w")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': reps = std::max (atoi (optarg), 1); break;
+			case 't': tolerance = atof (optarg); break;
+			case 'b': options.breadth_first = true; break;
+			case 'c': options.compact = atoi (optarg) & 3; break;
+			case 'w': record = true; break;
+			default:
+				optind = argc + 1;
+				break;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		cerr << "usage: " << argv[0] << " [-n repetitions] [-t tolerance] [-b] [-c order] [-w] baseline-file\n";
+		return 2;
+	}
+	const char *path = argv[optind];
+
+	std::vector<Measurement> baseline;
+	if (!record)
+	{
+		std::ifstream is (path);
+		Measurement m;
+		while (is >> m)
+			baseline.push_back (m);
+		if (baseline.empty ())
+		{
+			cerr << path << ": no baseline; record one with -w\n";
+			return 2;
+		}
+	}
+
+	/* Silence the search progress reports */
+	std::ostringstream chatter;
+	std::streambuf *clog_buf = clog.rdbuf (chatter.rdbuf ());
+
+	SpinFeb85 board;
+	std::vector<Measurement> results;
+	unsigned int regressions = 0;
+
+	cout.setf (ios::fixed, ios::floatfield);
+	cout.precision (4);
+	for (const auto& scenario : scenarios)
+	{
+		Measurement m = measure (board, options, scenario, reps);
+		chatter.str ("");
+		results.push_back (m);
+
+		cout << std::left << std::setw(22) << m.name << std::right <<
+			" time " << m.median << " +/- " << m.stddev <<
+			" nodes " << std::setw(8) << m.nodes <<
+			" peak " << std::setw(7) << m.peak_bytes / 1024 << 'K';
+
+		if (!record)
+		{
+			auto base = std::find_if (baseline.begin (), baseline.end (),
+				[&m] (const Measurement& b) { return b.name == m.name; });
+			if (base == baseline.end ())
+				cout << " (new)";
+			else
+			{
+				std::string flags = compare (*base, m, tolerance);
+				cout << std::showpos << std::setprecision(1) <<
+					" (" << 100.0 * (m.median - base->median) / base->median << "%)" <<
+					std::noshowpos << std::setprecision(4);
+				if (!flags.empty ())
+				{
+					cout << " REGRESSED:" << flags;
+					regressions++;
+				}
+			}
+		}
+		cout << '\n';
+	}
+
+	clog.rdbuf (clog_buf);
+
+	if (record)
+	{
+		std::ofstream os (path);
+		os.precision (6);
+		for (const auto& m : results)
+			os << m << '\n';
+		cout << "baseline written to " << path << '\n';
+		return 0;
+	}
+
+	cout << regressions << " of " << results.size () << " scenarios regressed\n";
+	return regressions ? 1 : 0;
+}
@@ -1,5 +1,12 @@
 
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <sys/mman.h>
+
 #include "pyl.hpp"
+#include "pyl_perf.hpp"
 
 namespace pyl {
 
@@ -101,29 +108,6 @@ void State::change_player ()
 	}
 }
 
-/**
- * Compute the composition of two spin results sv1 and sv2.
- *
- * This produces a new, combined spin result which has the effect of sv2
- * followed by sv1.
- *
- * This allows the application of multiple spins to be precomputed into a
- * single operator, due to associativity: P(Q(x)) == (PQ)x.  When the
- * spin results are commutative (neither is a whammy), then the results
- * can be simply added.
- */
-SpinValue operator* (const SpinValue& sv1, const SpinValue& sv2)
-{
-	if (sv2.whammy())
-		return sv2;
-	else if (sv1.whammy())
-		return SpinValue (0, sv2.earned(), 1+sv2.taken());
-	else
-	{
-		return SpinValue (sv1.score(), sv2.score(), sv1.earned()+sv2.earned(), sv1.taken()+sv2.taken());
-	}
-}
-
 /**
  * Apply the spin operator to a state.
  * TODO
@@ -143,6 +127,7 @@ ProbState SpinOperator::operator* (const State& ds) const
  */
 SpinOperator SpinOperator::operator() (const SpinOperator& sop) const
 {
+	PERF_SCOPE(PERF_SPIN_OPERATOR);
 	SpinOperator res;
 	for (const auto& t : sop.expr.terms) /* merge with SpinValue operator* above */
 		for (const auto& u : expr.terms)
@@ -155,14 +140,195 @@ SpinOperator SpinOperator::operator() (const SpinOperator& sop) const
  */
 bool SpinOperator::operator== (const SpinOperator& other) const
 {
+	if (expr.size() != other.expr.size())
+		return false;
 	for (const auto& term : expr.terms)
-		if (term.second != other.expr.terms.at(term.first))
+	{
+		auto it = other.expr.terms.find (term.first);
+		if (it == other.expr.terms.end() || term.second != it->second)
 			return false;
+	}
 	return true;
 }
 
 /*********************************************************************/
 
+const char *MemoryStats::name (MemoryCategory cat)
+{
+	switch (cat)
+	{
+		case MEM_NODES: return "nodes";
+		case MEM_BRANCHES: return "branches";
+		case MEM_BUCKETS: return "buckets";
+		case MEM_SPIN_TABLES: return "spin";
+		default: return "?";
+	}
+}
+
+/**
+ * Print live bytes (and live allocation count) per category, followed by
+ * the total and peak, all in kilobytes.
+ */
+void MemoryStats::print (std::ostream& os)
+{
+	for (int cat = 0; cat < MEM_CATEGORIES; ++cat)
+	{
+		const MemoryUsage& u = usage[cat];
+		os << name (MemoryCategory(cat)) << ' ' << u.bytes / 1024 << "K/" << u.count;
+		os << " (peak " << u.peak_bytes / 1024 << "K), ";
+	}
+	os << "total " << total_bytes / 1024 << "K, peak " << peak_bytes / 1024 << 'K';
+}
+
+/*********************************************************************/
+
+int PageHeap::size_class (size_t bytes)
+{
+	if (bytes <= 8 * SmallClasses)
+		return bytes ? (bytes - 1) / 8 : 0;
+	/* bytes is in (2^k, 2^(k+1)], which is split into four steps */
+	int k = 63 - __builtin_clzll (bytes - 1);
+	size_t step = size_t(1) << (k - 2);
+	return SmallClasses + (k - 6) * 4 + ((bytes - 1) - (size_t(1) << k)) / step;
+}
+
+size_t PageHeap::class_size (int c)
+{
+	if (c < SmallClasses)
+		return (c + 1) * 8;
+	int k = 6 + (c - SmallClasses) / 4;
+	return (size_t(1) << k) + ((c - SmallClasses) % 4 + 1) * (size_t(1) << (k - 2));
+}
+
+/* The size of the mapping for a large block: whole huge pages once the
+block is big enough to fill most of one, so that it can be backed by them */
+size_t PageHeap::large_size (size_t bytes)
+{
+	size_t page = bytes >= HugePageSize / 2 ? HugePageSize : 4096;
+	return (bytes + page - 1) & ~(page - 1);
+}
+
+void *PageHeap::map (size_t bytes)
+{
+	void *p;
+	if (!explicit_failed_ && bytes % HugePageSize == 0)
+	{
+		p = mmap (nullptr, bytes, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			kind_ = PAGES_EXPLICIT;
+			mapped_bytes_ += bytes;
+			return p;
+		}
+		explicit_failed_ = true;
+	}
+
+	if (!transparent_failed_ && bytes % HugePageSize == 0)
+	{
+		/* Over-allocate to align the mapping to a huge page, then trim */
+		p = mmap (nullptr, bytes + HugePageSize, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			throw std::bad_alloc ();
+		char *base = static_cast<char *> (p);
+		char *aligned = reinterpret_cast<char *> (
+			(reinterpret_cast<uintptr_t> (base) + HugePageSize - 1) & ~(HugePageSize - 1));
+		if (aligned > base)
+			munmap (base, aligned - base);
+		if (base + HugePageSize > aligned)
+			munmap (aligned + bytes, base + HugePageSize - aligned);
+		if (madvise (aligned, bytes, MADV_HUGEPAGE) == 0)
+		{
+			if (kind_ < PAGES_TRANSPARENT)
+				kind_ = PAGES_TRANSPARENT;
+		}
+		else
+			transparent_failed_ = true;
+		mapped_bytes_ += bytes;
+		return aligned;
+	}
+
+	p = mmap (nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		throw std::bad_alloc ();
+	mapped_bytes_ += bytes;
+	return p;
+}
+
+void *PageHeap::allocate (size_t bytes)
+{
+	if (bytes > LargeSize)
+		return map (large_size (bytes));
+
+	int c = size_class (bytes);
+	if (FreeBlock *b = free_[c])
+	{
+		free_[c] = b->next;
+		return b;
+	}
+	size_t size = class_size (c);
+	if (next_ + size > end_)
+	{
+		/* The tail of the old chunk is left unused */
+		next_ = static_cast<char *> (map (ChunkSize));
+		end_ = next_ + ChunkSize;
+	}
+	void *p = next_;
+	next_ += size;
+	return p;
+}
+
+void PageHeap::deallocate (void *p, size_t bytes)
+{
+	if (!p)
+		return;
+	if (bytes > LargeSize)
+	{
+		munmap (p, large_size (bytes));
+		mapped_bytes_ -= large_size (bytes);
+		return;
+	}
+	int c = size_class (bytes);
+	FreeBlock *b = static_cast<FreeBlock *> (p);
+	b->next = free_[c];
+	free_[c] = b;
+}
+
+size_t PageHeap::page_size ()
+{
+	return kind_ == PAGES_NORMAL ? 4096 : HugePageSize;
+}
+
+/**
+ * Print the page size obtained, the bytes mapped, and the bytes that the
+ * kernel currently backs with transparent huge pages in the whole process
+ * (AnonHugePages), all in kilobytes or megabytes.  Transparent huge pages
+ * are only a hint, so the last figure shows whether it was taken.
+ */
+const char *PageHeap::kind_name (PageKind kind)
+{
+	static const char *const kinds[] = { "normal", "transparent", "explicit" };
+	return kinds[kind];
+}
+
+void PageHeap::print (std::ostream& os)
+{
+	os << page_size() / 1024 << "K " << kind_name (kind_) << ", " <<
+		mapped_bytes_ / (1024 * 1024) << "M mapped";
+
+	std::ifstream is ("/proc/self/smaps_rollup");
+	std::string line;
+	while (std::getline (is, line))
+		if (line.compare (0, 14, "AnonHugePages:") == 0)
+		{
+			os << ", " << strtoul (line.c_str() + 14, nullptr, 10) / 1024 << "M huge";
+			break;
+		}
+}
+
+/*********************************************************************/
+
 ostream& operator<< (ostream& os, const State& d)
 {
 	if (!d.terminal ())
@@ -11,13 +11,16 @@
 #include <numeric>
 
 #include "interval.hpp"
+#include "pyl_memory.hpp"
 
 /* TODO - add reserve() to vectors where possible */
 
-//#define MAP_CACHE need to define State operator< first
-
 using namespace std;
 
+#ifndef PYL_SCORE_UNIT
+#define PYL_SCORE_UNIT 250
+#endif
+
 namespace pyl {
 
 constexpr int num_players = 3;
@@ -40,44 +43,53 @@ struct SpinValue
 	For example, since 700 and 750 are both stored as 750, either 1400/1500
 	followed by 700/750 would yield 1 unique outcome called 2250, when in
 	reality it could have been 2100, 2150, or 2200 also.
-	   TODO: Making this a power of 2 will speed up construction. */
-	static constexpr int MinScoreUnit = 250;
+	   TODO: Making this a power of 2 will speed up construction.
+	   It can be overridden at build time with SCORE_UNIT=n. */
+	static constexpr int MinScoreUnit = PYL_SCORE_UNIT;
 
 	/* MaxScore is used to saturate the score value.
 	   MaxScore must be a multiple of MinScoreUnit. */
 	static constexpr int MaxScore = 20000;
+	static_assert (MaxScore % MinScoreUnit == 0, "MaxScore must be a multiple of MinScoreUnit");
 
 	/* TODO - storing only the number of units and not the actual score will
 	speed construction and save space.  Right now a score only needs 7-bits. */
 
-	/* Constructor */
-	SpinValue (int score = 0, int earned = 0, int taken = 1)
+	/* Constructor.  The constructors are constexpr so that boards can be
+	built at compile time (see pyl_table.hpp). */
+	constexpr SpinValue (int score = 0, int earned = 0, int taken = 1) :
+		u_{ { static_cast<unsigned int> (std::min (SpinValue::MaxScore,
+			((score + (MinScoreUnit/2)) / MinScoreUnit) * MinScoreUnit)),
+			static_cast<unsigned int> (earned), static_cast<unsigned int> (taken) } }
 	{
-		u_.score = std::min (SpinValue::MaxScore,
-			((score + (MinScoreUnit/2)) / MinScoreUnit) * MinScoreUnit);
-		u_.earned = earned;
-		u_.taken = taken;
 	}
 
-	SpinValue (int score1, int score2, int earned, int taken)
+	constexpr SpinValue (int score1, int score2, int earned, int taken) :
+		u_{ { static_cast<unsigned int> (std::min (SpinValue::MaxScore, score1+score2)),
+			static_cast<unsigned int> (earned), static_cast<unsigned int> (taken) } }
 	{
-		u_.score = std::min (SpinValue::MaxScore, score1+score2);
-		u_.earned = earned;
-		u_.taken = taken;
 	}
 
 
-	int score () const { return u_.score; }
-	int earned () const { return u_.earned; }
-	int taken () const { return u_.taken; }
+	constexpr int score () const { return u_.score; }
+	constexpr int earned () const { return u_.earned; }
+	constexpr int taken () const { return u_.taken; }
 
 	unsigned int intval () const { return u_.all; }
 
+	/* Rebuild a value from intval() */
+	static SpinValue from_intval (unsigned int all)
+	{
+		SpinValue res;
+		res.u_.all = all;
+		return res;
+	}
+
 	void print (std::ostream& os) const {
 		os << u_.score << ' ' << u_.earned << ' ' << u_.taken;
 	}
 
-	bool whammy () const { return score() == 0; }
+	constexpr bool whammy () const { return score() == 0; }
 	bool operator== (const SpinValue& other) const { return intval() == other.intval(); }
 private:
 	/* For space savings, the 3 values are packed into one 32-bit integer. */
@@ -215,12 +227,13 @@ struct hash<State>
  * WeightedSet - container for a set of items each with associated probability.
  * TODO - move to separate header.
  */
-template <class T, class K>
+template <class T, class K, class Alloc = std::allocator<std::pair<const T, K>>>
 struct WeightedSet
 {
 	/* std container used to hold the elements.  We use an unordered_map, i.e.
-	hash table that maps the element of type T to its probability of type K. */
-	typedef unordered_map<T,K> Container;
+	hash table that maps the element of type T to its probability of type K.
+	The allocator can be overridden so that long-lived sets are accounted. */
+	typedef unordered_map<T, K, std::hash<T>, std::equal_to<T>, Alloc> Container;
 
 	Container terms;
 
@@ -279,8 +292,8 @@ struct WeightedSet
 	size_t size() const { return terms.size(); }
 };
 
-template <typename T, typename K>
-ostream& operator<< (ostream& os, const WeightedSet<T,K>& lc)
+template <typename T, typename K, typename A>
+ostream& operator<< (ostream& os, const WeightedSet<T,K,A>& lc)
 {
 	os << '[';
 	for (const auto& term : lc.terms)
@@ -314,12 +327,24 @@ struct Operator
  */
 struct SpinOperator : public Operator
 {
-	WeightedSet<SpinValue, Prob> expr;
+	typedef TrackingAllocator<std::pair<const SpinValue, Prob>, MEM_SPIN_TABLES> Allocator;
+	WeightedSet<SpinValue, Prob, Allocator> expr;
 
 	ProbState operator* (const State& ds) const;
 	SpinOperator operator() (const SpinOperator& in) const;
 	bool operator== (const SpinOperator& other) const;
 
+	/* Return a lossy copy of the board with some outcomes replaced by
+	their neighbours, which reduces the number of distinct outcomes. */
+	SpinOperator spread () const
+	{
+		SpinOperator res(*this);
+		res.expr.spread (SpinValue(4000, 1), SpinValue(3000, 1), SpinValue(5000,1));
+		res.expr.spread (SpinValue(1750), SpinValue(1500), SpinValue(2000));
+		res.expr.spread (SpinValue(2250), SpinValue(2000), SpinValue(2500));
+		return res;
+	}
+
 protected:
 	/* The protected methods are helpers for derived classes to
 	   construct the board values efficiently. */
@@ -333,15 +358,6 @@ protected:
 	/* Add a prize */
 	void P (Prob p=0.0) { S(2500, p); }
 
-	SpinOperator spread () const
-	{
-		SpinOperator res(*this);
-		res.expr.spread (SpinValue(4000, 1), SpinValue(3000, 1), SpinValue(5000,1));
-		res.expr.spread (SpinValue(1750), SpinValue(1500), SpinValue(2000));
-		res.expr.spread (SpinValue(2250), SpinValue(2000), SpinValue(2500));
-		return res;
-	}
-
 };
 
 struct Spin1 : public SpinOperator
@@ -369,35 +385,48 @@ struct SpinFeb85 : public SpinOperator
 	constexpr static Prob A2 = 1 / 3.0;
 	constexpr static Prob BB = 1 / 3.0;
 
-	SpinFeb85() : SpinOperator()
+	/* The movement space weights can be overridden to study how sensitive
+	a decision is to them.  Any choice gives the same set of outcomes. */
+	SpinFeb85(Prob PC = SpinFeb85::PC, Prob B2 = SpinFeb85::B2, Prob M1 = SpinFeb85::M1,
+		Prob A2 = SpinFeb85::A2, Prob BB = SpinFeb85::BB) :
+		SpinOperator()
 	{
-		/* Each call to S, SE, P, or W can pass an additional probability value,
-		which is added to the normal probability of 1.0, for cases when that
-		space might be awarded due to another "movement space" such as Big Bucks,
-		Go Back 2 Spaces, etc. */
-		/* 1 */ S(1400,PC); S(1750,PC); S(2250,PC);
-		/* 2 */ S(500); S(1250); P();
-		/* 3 */ S(500), S(2000), W();
-		/* 4 */ SE(3000,B2+BB); SE(4000,B2+BB); SE(5000,B2+BB);
-		/* 5 */ S(750); P(); W();
-		/* 6 */ SE(700); /* PC=PickACorner; B2=GoBack2; */
-		/* 7 */ S(750); P(); W();
-		/* 8 */ SE(500,M1); SE(750,M1); SE(1000,M1);
-		/* 9 */ S(800); W(); /* Move1(); */
-		/* 10 */ P(PC+M1); P(PC+M1); P(PC+M1);
-		/* 11 */ S(1500); W(); /* Advance2(); */
-		/* 12 */ S(500); W(); /* BB=BigBucks; */
-		/* 13 */ S(1500,A2+M1); S(2500,A2+M1); P(A2+M1);
-		/* 14 */ S(2000); W(); /* Move1(); */
-		/* 15 */ SE(1000,PC+M1); S(2000,PC+M1); P(PC+M1);
-		/* 16 */ SE(750); SE(1500); W();
-		/* 17 */ S(600); SE(700); P();
-		/* 18 */ SE(750); SE(1000); W();
+		squares (*this, PC, B2, M1, A2, BB);
 
 		/* Always normalize at the end of constructor so that the sum of all
 		probabilities is 1.0 */
 		expr.normalize();
 	}
+
+	/* Add the squares of the board to b, which provides S, SE, P and W.
+	This is a template so that the same list also builds the board at
+	compile time (see pyl_table.hpp). */
+	template <class B>
+	static constexpr void squares (B& b, Prob PC, Prob B2, Prob M1, Prob A2, Prob BB)
+	{
+		/* Each call to S, SE, P, or W can pass an additional probability value,
+		which is added to the normal probability of 1.0, for cases when that
+		space might be awarded due to another "movement space" such as Big Bucks,
+		Go Back 2 Spaces, etc. */
+		/* 1 */ b.S(1400,PC); b.S(1750,PC); b.S(2250,PC);
+		/* 2 */ b.S(500); b.S(1250); b.P();
+		/* 3 */ b.S(500), b.S(2000), b.W();
+		/* 4 */ b.SE(3000,B2+BB); b.SE(4000,B2+BB); b.SE(5000,B2+BB);
+		/* 5 */ b.S(750); b.P(); b.W();
+		/* 6 */ b.SE(700); /* PC=PickACorner; B2=GoBack2; */
+		/* 7 */ b.S(750); b.P(); b.W();
+		/* 8 */ b.SE(500,M1); b.SE(750,M1); b.SE(1000,M1);
+		/* 9 */ b.S(800); b.W(); /* Move1(); */
+		/* 10 */ b.P(PC+M1); b.P(PC+M1); b.P(PC+M1);
+		/* 11 */ b.S(1500); b.W(); /* Advance2(); */
+		/* 12 */ b.S(500); b.W(); /* BB=BigBucks; */
+		/* 13 */ b.S(1500,A2+M1); b.S(2500,A2+M1); b.P(A2+M1);
+		/* 14 */ b.S(2000); b.W(); /* Move1(); */
+		/* 15 */ b.SE(1000,PC+M1); b.S(2000,PC+M1); b.P(PC+M1);
+		/* 16 */ b.SE(750); b.SE(1500); b.W();
+		/* 17 */ b.S(600); b.SE(700); b.P();
+		/* 18 */ b.SE(750); b.SE(1000); b.W();
+	}
 };
 
 struct SpinTest : public SpinOperator
@@ -416,6 +445,29 @@ struct PassOperator : public Operator
 	ProbState operator() (const State& in) const;
 };
 
+/**
+ * Compute the composition of two spin results sv1 and sv2.
+ *
+ * This produces a new, combined spin result which has the effect of sv2
+ * followed by sv1.
+ *
+ * This allows the application of multiple spins to be precomputed into a
+ * single operator, due to associativity: P(Q(x)) == (PQ)x.  When the
+ * spin results are commutative (neither is a whammy), then the results
+ * can be simply added.
+ */
+constexpr SpinValue operator* (const SpinValue& sv1, const SpinValue& sv2)
+{
+	if (sv2.whammy())
+		return sv2;
+	else if (sv1.whammy())
+		return SpinValue (0, sv2.earned(), 1+sv2.taken());
+	else
+	{
+		return SpinValue (sv1.score(), sv2.score(), sv1.earned()+sv2.earned(), sv1.taken()+sv2.taken());
+	}
+}
+
 ostream& operator<< (ostream& os, const State& d);
 ostream& operator<< (ostream& os, const SpinValue& v);
 ostream& operator<< (ostream& os, const SpinOperator *sop);
@@ -426,7 +478,6 @@ bool operator== (const Player& p0, const Player& p1);
 bool operator== (const State& ds0, const State& ds1);
 State operator* (const SpinValue& opv, const State& sv);
 State operator* (const PassOperator& op, const State& sv);
-SpinValue operator* (const SpinValue& sv1, const SpinValue& sv2);
 
 } // namespace pyl
 
@@ -0,0 +1,202 @@
+
+#include "pyl_batch.hpp"
+
+namespace pyl {
+
+bool BoardBatch::add_board (const SpinOperator& board)
+{
+	if (boards_.size () == MaxBoards)
+		return false;
+	if (!boards_.empty ())
+	{
+		const auto& first = boards_[0].expr.terms;
+		if (board.expr.terms.size () != first.size ())
+			return false;
+		for (const auto& term : board.expr.terms)
+			if (!first.count (term.first))
+				return false;
+	}
+
+	boards_.push_back (board);
+	Powers powers;
+	powers[0] = powers[1] = board;
+	for (size_t n = 2; n < powers.size (); ++n)
+		powers[n] = board (powers[n - 1]);
+	powers_.push_back (powers);
+	return true;
+}
+
+/**
+ * Build the graph with the first board, then evaluate it for all boards.
+ * Every payoff left by the search is discarded first, so that the sweep
+ * covers the whole graph; only terminal payoffs, which do not depend on
+ * the board, are kept as inputs.  For that, the search must not freeze
+ * any part of the graph.
+ */
+std::vector<SearchResult> BoardBatch::run (State init)
+{
+	std::vector<SearchResult> results (boards_.size ());
+	if (boards_.empty ())
+		return results;
+
+	SearchOptions options = options_;
+	options.freeze = false;
+	sweep_ = PayoffSweep ();
+	search_.reset ();
+	search_ = std::make_unique<Search> (boards_[0], options);
+	root_ = search_->run (init);
+	search_->node_cache_->apply ([] (Node *node) {
+		if (!node->state.terminal ())
+			node->payoff_.invalidate ();
+	});
+
+	sweep_.compile (root_);
+	weigh (sweep_);
+	evaluate (sweep_);
+
+	auto up = root_->state.up_num ();
+	for (size_t b = 0; b < boards_.size (); ++b)
+	{
+		if (root_->if_play)
+			results[b].play_win = lane (sweep_.find (root_->if_play), b).range (up);
+		if (root_->if_pass)
+			results[b].pass_win = lane (sweep_.find (root_->if_pass), b).range (up);
+	}
+	return results;
+}
+
+/**
+ * Compute the branch probabilities of every spin row for every board.
+ * Edges are stored in the same order as SpinNode::branches.
+ */
+void BoardBatch::weigh (const PayoffSweep& sweep)
+{
+	weight_.assign (sweep.col_.size (), Lanes{});
+	for (size_t r = 0; r < sweep.spin_target_.size (); ++r)
+	{
+		const SpinNode *node = static_cast<const SpinNode *> (sweep.nodes_[sweep.spin_target_[r]]);
+		for (size_t b = 0; b < boards_.size (); ++b)
+		{
+			ProbState next = node->outcomes (powers_[b].data ());
+			uint32_t e = sweep.row_ptr_[r];
+			for (const auto& branch : node->branches)
+			{
+				auto it = next.terms.find (branch.second->state);
+				weight_[e++][b] = (it != next.terms.end ()) ? it->second : 0.0;
+			}
+		}
+	}
+}
+
+/**
+ * Evaluate the levels of the sweep with one lane per board.  This follows
+ * PayoffSweep::evaluate, with the same multiply-add, except that a decide
+ * node chooses separately in each lane.  A lane thus matches a single-board
+ * sweep with the same branch probabilities bit for bit.
+ */
+void BoardBatch::evaluate (const PayoffSweep& sweep)
+{
+	values_.resize (sweep.size ());
+	for (size_t s = 0; s < sweep.size (); ++s)
+	{
+		const Payoff& p = sweep.values[s];
+		for (size_t n = 0; n < num_players; ++n)
+			values_[s][n].fill (p.is_null () ? 0.0 : p[n]);
+	}
+
+	for (const PayoffSweep::Level& l : sweep.levels_)
+	{
+		for (uint32_t r = l.spin_begin; r < l.spin_end; ++r)
+		{
+			BatchPayoff& out = values_[sweep.spin_target_[r]];
+#ifdef __SSE__
+			__m128 acc[num_players];
+			for (size_t n = 0; n < num_players; ++n)
+				acc[n] = _mm_setzero_ps ();
+			for (uint32_t e = sweep.row_ptr_[r]; e < sweep.row_ptr_[r + 1]; ++e)
+			{
+				__m128 w = _mm_loadu_ps (weight_[e].data ());
+				const BatchPayoff& v = values_[sweep.col_[e]];
+				for (size_t n = 0; n < num_players; ++n)
+					acc[n] = Payoff::fma (acc[n], _mm_loadu_ps (v[n].data ()), w);
+			}
+			for (size_t n = 0; n < num_players; ++n)
+				_mm_storeu_ps (out[n].data (), acc[n]);
+#else
+			for (auto& lanes : out)
+				lanes.fill (0.0);
+			for (uint32_t e = sweep.row_ptr_[r]; e < sweep.row_ptr_[r + 1]; ++e)
+			{
+				const BatchPayoff& v = values_[sweep.col_[e]];
+				for (size_t n = 0; n < num_players; ++n)
+					for (size_t b = 0; b < MaxBoards; ++b)
+						out[n][b] += weight_[e][b] * v[n][b];
+			}
+#endif
+		}
+
+		for (uint32_t d = l.decide_begin; d < l.decide_end; ++d)
+		{
+			const PayoffSweep::DecideEntry& entry = sweep.decide_[d];
+			BatchPayoff& out = values_[entry.target];
+			if (entry.play == PayoffSweep::NoChild && entry.pass == PayoffSweep::NoChild)
+			{
+				for (auto& lanes : out)
+					lanes.fill (0.0);
+				continue;
+			}
+			if (entry.play == PayoffSweep::NoChild || entry.pass == PayoffSweep::NoChild)
+			{
+				out = values_[entry.play == PayoffSweep::NoChild ? entry.pass : entry.play];
+				continue;
+			}
+
+			const BatchPayoff& play = values_[entry.play];
+			const BatchPayoff& pass = values_[entry.pass];
+#ifdef __SSE__
+			/* Per lane: play if better for the player up, pass if
+			better, otherwise the pessimistic merge of the two. */
+			__m128 play_up = _mm_loadu_ps (play[entry.up].data ());
+			__m128 pass_up = _mm_loadu_ps (pass[entry.up].data ());
+			__m128 use_play = _mm_cmpgt_ps (play_up, pass_up);
+			__m128 use_pass = _mm_cmpgt_ps (pass_up, play_up);
+			__m128 use_min = _mm_cmpeq_ps (play_up, pass_up);
+			for (size_t n = 0; n < num_players; ++n)
+			{
+				__m128 a = _mm_loadu_ps (play[n].data ());
+				__m128 b = _mm_loadu_ps (pass[n].data ());
+				__m128 res = _mm_or_ps (_mm_and_ps (use_play, a),
+					_mm_or_ps (_mm_and_ps (use_pass, b), _mm_and_ps (use_min, _mm_min_ps (a, b))));
+				_mm_storeu_ps (out[n].data (), res);
+			}
+#else
+			for (size_t b = 0; b < MaxBoards; ++b)
+			{
+				Prob win_play = play[entry.up][b];
+				Prob win_pass = pass[entry.up][b];
+				for (size_t n = 0; n < num_players; ++n)
+				{
+					if (win_play > win_pass)
+						out[n][b] = play[n][b];
+					else if (win_pass > win_play)
+						out[n][b] = pass[n][b];
+					else
+						out[n][b] = std::min (play[n][b], pass[n][b]);
+				}
+			}
+#endif
+		}
+	}
+}
+
+/* Return one board's payoff from a slot */
+Payoff BoardBatch::lane (PayoffSweep::Slot slot, size_t board) const
+{
+	Payoff res;
+	res.clear ();
+	for (size_t n = 0; n < num_players; ++n)
+		res.assign (n, values_[slot][n][board]);
+	return res;
+}
+
+} // namespace pyl
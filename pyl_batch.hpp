@@ -0,0 +1,75 @@
+#ifndef __PYL_BATCH_H
+#define __PYL_BATCH_H
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "pyl_search.hpp"
+#include "pyl_sweep.hpp"
+
+namespace pyl {
+
+/*
+ * BoardBatch - solves one root under several boards at once.
+ *
+ * Boards with the same set of outcomes, such as SpinFeb85 with different
+ * movement space weights, produce the same graph; only the branch
+ * probabilities differ.  The graph is built once by a normal search with
+ * the first board.  It is then compiled with PayoffSweep and evaluated
+ * for all boards together, with one SIMD lane per board in every branch
+ * probability and payoff.
+ *
+ * The depth of the search is chosen by the first board, so the other
+ * boards' results may be less certain than a search of their own.
+ */
+struct BoardBatch
+{
+	static constexpr size_t MaxBoards = 4;
+
+	/* One value per board */
+	typedef std::array<Prob, MaxBoards> Lanes;
+	/* Per player win probabilities, one lane per board */
+	typedef std::array<Lanes, num_players> BatchPayoff;
+
+	explicit BoardBatch (const SearchOptions& options) : options_(options) {}
+
+	/* Add a board.  Returns false if the batch is full, or if the board's
+	outcomes differ from those of the first board. */
+	bool add_board (const SpinOperator& board);
+
+	size_t size () const { return boards_.size(); }
+
+	/* Search init and return one result per board, in the order added.
+	The search, its graph and the sweep are kept until the next run. */
+	std::vector<SearchResult> run (State init);
+
+	/* The root of the last run and the sweep over its graph */
+	DecideNode *root () const { return root_; }
+	const PayoffSweep& sweep () const { return sweep_; }
+
+	/* Return one board's payoff from a slot of the last run */
+	Payoff lane (PayoffSweep::Slot slot, size_t board) const;
+
+private:
+	typedef std::array<SpinOperator, Search::MaxPassedSpins> Powers;
+
+	void weigh (const PayoffSweep& sweep);
+	void evaluate (const PayoffSweep& sweep);
+
+	SearchOptions options_;
+	std::vector<SpinOperator> boards_;
+	std::vector<Powers> powers_;
+
+	/* Per edge branch probabilities, and per slot payoffs */
+	std::vector<Lanes> weight_;
+	std::vector<BatchPayoff> values_;
+
+	std::unique_ptr<Search> search_;
+	DecideNode *root_ = nullptr;
+	PayoffSweep sweep_;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_BATCH_H */
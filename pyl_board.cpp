@@ -0,0 +1,292 @@
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+#include "pyl_board.hpp"
+
+namespace pyl {
+
+namespace {
+
+/* Parse a decimal or a fraction such as 1/9 */
+bool parse_number (const std::string& text, double& value)
+{
+	size_t slash = text.find ('/');
+	std::string num = text.substr (0, slash);
+	char *end;
+	value = strtod (num.c_str(), &end);
+	if (num.empty() || *end != '\0')
+		return false;
+	if (slash == std::string::npos)
+		return true;
+
+	std::string den = text.substr (slash + 1);
+	double divisor = strtod (den.c_str(), &end);
+	if (den.empty() || *end != '\0' || divisor == 0.0)
+		return false;
+	value /= divisor;
+	return true;
+}
+
+/* Split text at every occurrence of sep */
+std::vector<std::string> split (const std::string& text, char sep)
+{
+	std::vector<std::string> res;
+	std::istringstream is (text);
+	std::string part;
+	while (std::getline (is, part, sep))
+		res.push_back (part);
+	return res;
+}
+
+struct PowerCacheHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t score_unit;
+	uint64_t hash;
+	uint32_t count[Search::MaxPassedSpins];
+};
+
+struct PowerCacheTerm
+{
+	uint32_t value;
+	Prob prob;
+};
+
+const char power_cache_magic[8] = { 'P', 'Y', 'L', 'P', 'O', 'W', 'E', 'R' };
+const uint32_t power_cache_version = 2;
+
+} // namespace
+
+/**
+ * Read a board in the text format.  name is used in error messages.
+ */
+bool TextBoard::load (std::istream& is, const std::string& name)
+{
+	std::map<std::string, Prob> weights;
+	expr.terms.clear ();
+
+	std::string line;
+	int line_num = 0;
+	auto error = [&] (const std::string& message) {
+		clog << name << ':' << line_num << ": " << message << '\n';
+		return false;
+	};
+
+	while (std::getline (is, line))
+	{
+		line_num++;
+		line = line.substr (0, line.find ('#'));
+		std::istringstream words (line);
+		std::string keyword;
+		if (!(words >> keyword))
+			continue;
+
+		if (keyword == "weight")
+		{
+			std::string weight_name, text;
+			double value;
+			if (!(words >> weight_name >> text) || !parse_number (text, value))
+				return error ("expected: weight NAME VALUE");
+			weights[weight_name] = value;
+		}
+		else if (keyword == "square")
+		{
+			std::string outcome;
+			while (words >> outcome)
+			{
+				/* Extra probability from movement spaces */
+				size_t slash = outcome.find ('/');
+				Prob p = 0.0;
+				if (slash != std::string::npos)
+				{
+					for (const auto& term : split (outcome.substr (slash + 1), '+'))
+					{
+						double value;
+						auto it = weights.find (term);
+						if (it != weights.end())
+							p += it->second;
+						else if (parse_number (term, value))
+							p += value;
+						else
+							return error ("unknown weight '" + term + "'");
+					}
+					outcome.erase (slash);
+				}
+
+				bool spin = (!outcome.empty() && outcome.back() == '+');
+				if (spin)
+					outcome.pop_back ();
+
+				if (outcome == "W" && !spin)
+				{
+					if (p == 0.0)
+						W ();
+					else
+						expr.add (1.0+p, SpinValue(0, 0));
+				}
+				else if (outcome == "P")
+				{
+					if (spin)
+						SE (2500, p);
+					else
+						P (p);
+				}
+				else
+				{
+					char *end;
+					long score = strtol (outcome.c_str(), &end, 10);
+					if (outcome.empty() || *end != '\0' || score <= 0)
+						return error ("bad outcome '" + outcome + "'");
+					if (spin)
+						SE (score, p);
+					else
+						S (score, p);
+				}
+			}
+		}
+		else
+			return error ("unknown keyword '" + keyword + "'");
+	}
+
+	if (expr.terms.empty())
+		return error ("no squares");
+	expr.normalize ();
+	return true;
+}
+
+bool TextBoard::load (const std::string& path)
+{
+	std::ifstream is (path);
+	if (!is)
+	{
+		clog << path << ": cannot open\n";
+		return false;
+	}
+	return load (is, path);
+}
+
+/**
+ * FNV-1a over the score unit and the board's terms in SpinValue order.
+ * Two boards with the same hash have the same powers.
+ */
+uint64_t board_hash (const SpinOperator& board)
+{
+	std::vector<std::pair<unsigned int, Prob>> terms;
+	for (const auto& term : board.expr.terms)
+		terms.emplace_back (term.first.intval(), term.second);
+	std::sort (terms.begin(), terms.end());
+
+	uint64_t hash = 14695981039346656037ULL;
+	auto mix = [&hash] (const void *data, size_t size) {
+		const unsigned char *bytes = static_cast<const unsigned char *> (data);
+		for (size_t n = 0; n < size; ++n)
+			hash = (hash ^ bytes[n]) * 1099511628211ULL;
+	};
+	int score_unit = SpinValue::MinScoreUnit;
+	mix (&score_unit, sizeof(score_unit));
+	for (const auto& term : terms)
+	{
+		mix (&term.first, sizeof(term.first));
+		mix (&term.second, sizeof(term.second));
+	}
+	return hash;
+}
+
+void SpinPowers::compute (const SpinOperator& board)
+{
+	op[0] = op[1] = board;
+	for (int n = 2; n < Search::MaxPassedSpins; ++n)
+		op[n] = board (op[n-1]);
+}
+
+/**
+ * Read the powers from a cache file.  Returns false if the file is
+ * missing, or was written for another board or another score unit.
+ *
+ * The terms are added in the order they were saved, but the hash tables
+ * need not iterate them in that order, so a search from loaded powers may
+ * visit branches in another order than one from computed powers, and its
+ * payoffs may round differently in the last bit.
+ */
+bool SpinPowers::load (const std::string& path, uint64_t hash)
+{
+	std::ifstream is (path, std::ios::binary | std::ios::ate);
+	if (!is)
+		return false;
+	size_t size = is.tellg ();
+	PowerCacheHeader header;
+	if (size < sizeof(header) ||
+		!is.seekg (0).read (reinterpret_cast<char *> (&header), sizeof(header)))
+		return false;
+
+	size_t count = 0;
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+		count += header.count[n];
+	if (memcmp (header.magic, power_cache_magic, sizeof(header.magic)) != 0 ||
+		header.version != power_cache_version ||
+		header.score_unit != SpinValue::MinScoreUnit ||
+		header.hash != hash ||
+		size != sizeof(header) + count * sizeof(PowerCacheTerm))
+		return false;
+
+	std::vector<PowerCacheTerm> buffer;
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+	{
+		buffer.resize (header.count[n]);
+		if (!is.read (reinterpret_cast<char *> (buffer.data()), buffer.size() * sizeof(PowerCacheTerm)))
+			return false;
+		auto& terms = op[n].expr.terms;
+		terms.clear ();
+		terms.reserve (buffer.size());
+		for (const auto& term : buffer)
+			terms.emplace (SpinValue::from_intval (term.value), term.prob);
+	}
+	return true;
+}
+
+bool SpinPowers::save (const std::string& path, uint64_t hash) const
+{
+	PowerCacheHeader header{};
+	memcpy (header.magic, power_cache_magic, sizeof(header.magic));
+	header.version = power_cache_version;
+	header.score_unit = SpinValue::MinScoreUnit;
+	header.hash = hash;
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+	{
+		header.count[n] = op[n].expr.size();
+	}
+
+	std::ofstream os (path, std::ios::binary);
+	os.write (reinterpret_cast<const char *> (&header), sizeof(header));
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+	{
+		for (const auto& term : op[n].expr.terms)
+		{
+			PowerCacheTerm t{ term.first.intval(), term.second };
+			os.write (reinterpret_cast<const char *> (&t), sizeof(t));
+		}
+	}
+	return bool(os);
+}
+
+void SpinPowers::cached (const SpinOperator& board, const std::string& dir)
+{
+	uint64_t hash = board_hash (board);
+	std::ostringstream path;
+	path << dir << '/' << std::hex << std::setw(16) << std::setfill('0') << hash << ".pow";
+	if (load (path.str(), hash))
+		return;
+	compute (board);
+	if (!save (path.str(), hash))
+		clog << path.str() << ": cannot write power cache\n";
+}
+
+} // namespace pyl
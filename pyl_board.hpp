@@ -0,0 +1,77 @@
+#ifndef __PYL_BOARD_H
+#define __PYL_BOARD_H
+
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <utility>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_table.hpp"
+
+namespace pyl {
+
+/*
+ * TextBoard - a board read from a text description at run time.
+ *
+ * The format is line oriented, and '#' starts a comment:
+ *
+ *    weight PC 1/9
+ *    square 1400/PC 1750/PC 2250/PC
+ *    square 3000+/B2+BB 4000+/B2+BB 5000+/B2+BB
+ *    square 750 P W
+ *
+ * A weight line names a movement space weight, as a decimal or fraction.
+ * Each square lists its outcomes.  An outcome is a score, P for a prize or
+ * W for a whammy.  A trailing + adds a spin, and /A+B adds the named
+ * weights to its probability of 1, for spaces that can also be reached
+ * through a movement space.
+ */
+struct TextBoard : public SpinOperator
+{
+	/* Read a board, reporting any error to clog.  Returns false on error. */
+	bool load (std::istream& is, const std::string& name);
+	bool load (const std::string& path);
+};
+
+/* Hash of a board's normalized outcomes and the score unit of the build */
+uint64_t board_hash (const SpinOperator& board);
+
+/*
+ * SpinPowers - the powers spin(spin(...)) of a board that Search uses for
+ * passed spins.  They can be computed by composition, or read from a
+ * binary cache file keyed by board_hash().
+ * For a board defined at compile time, assign<Board>() copies powers that
+ * the compiler has already composed.
+ */
+struct SpinPowers
+{
+	SpinOperator op[Search::MaxPassedSpins];
+
+	void compute (const SpinOperator& board);
+	bool load (const std::string& path, uint64_t hash);
+	bool save (const std::string& path, uint64_t hash) const;
+
+	/* Read the powers of board from its cache file in dir, or compute
+	them and write the cache file */
+	void cached (const SpinOperator& board, const std::string& dir);
+
+	template <const auto& Board>
+	void assign ()
+	{
+		assign_powers<Board> (std::make_integer_sequence<int, Search::MaxPassedSpins - 1> ());
+	}
+
+private:
+	template <const auto& Board, int... Spins>
+	void assign_powers (std::integer_sequence<int, Spins...>)
+	{
+		op[0] = Board.spin_operator ();
+		((op[Spins+1] = SpinPower<Board, Spins+1>::table.spin_operator ()), ...);
+	}
+};
+
+} // namespace pyl
+
+#endif /* __PYL_BOARD_H */
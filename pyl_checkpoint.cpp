@@ -0,0 +1,267 @@
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "pyl_checkpoint.hpp"
+#include "pyl_graph.hpp"
+#include "pyl_board.hpp"
+
+namespace pyl {
+
+namespace {
+
+const char checkpoint_magic[8] = { 'P', 'Y', 'L', 'C', 'K', 'P', 'N', 'T' };
+const uint32_t checkpoint_version = 1;
+
+/* An output buffer that appends straight to a string, which is much
+faster than an ostringstream for many small records */
+struct StringSink : std::streambuf
+{
+	std::string data;
+
+	std::streamsize xsputn (const char *s, std::streamsize n) override
+	{
+		data.append (s, n);
+		return n;
+	}
+	int_type overflow (int_type c) override
+	{
+		if (c != traits_type::eof())
+			data.push_back (traits_type::to_char_type (c));
+		return c;
+	}
+};
+
+/* Check that every spin branch leads to a node and that every decide node
+has its two choices.  GraphFile::open has checked that the targets are
+nodes or GraphNoNode; a search only leaves a choice out, never a branch,
+so anything else is a corrupt file and is rejected before any node is
+created. */
+bool valid_edges (const GraphFile& graph)
+{
+	for (uint64_t n = 0; n < graph.size(); ++n)
+	{
+		uint64_t begin = graph.offsets()[n], end = graph.offsets()[n + 1];
+		switch (graph.nodes()[n].kind)
+		{
+		case GRAPH_SPIN:
+			for (uint64_t e = begin; e < end; ++e)
+				if (graph.edges()[e].target == GraphNoNode)
+					return false;
+			break;
+		case GRAPH_DECIDE:
+			if (end - begin != 2)
+				return false;
+			break;
+		case GRAPH_TERMINAL:
+			if (end != begin)
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+std::string make_checkpoint (const Search& search, const Node *root, int depth)
+{
+	CheckpointHeader header{};
+	memcpy (header.magic, checkpoint_magic, sizeof(header.magic));
+	header.version = checkpoint_version;
+	header.depth = depth;
+	header.board = board_hash (search.spin_op[1]);
+
+	StringSink sink;
+	std::ostream os (&sink);
+	os.write (reinterpret_cast<const char *> (&header), sizeof(header));
+	write_graph (os, search, root);
+	return std::move (sink.data);
+}
+
+/**
+ * Create the nodes through the node cache, so that they are counted and
+ * found as usual, then restore their payoffs and frozen flags and link
+ * their edges in the order they were written.  Keeping the branch order
+ * keeps the scans of a resumed search the same as those of a search that
+ * was never stopped.
+ */
+bool load_checkpoint (Search& search, const std::string& path, State& root, int& depth)
+{
+	NodeCache& cache = *search.node_cache_;
+	if (cache.size() != 0)
+	{
+		clog << path << ": can only resume into an empty search\n";
+		return false;
+	}
+
+	CheckpointHeader header{};
+	{
+		std::ifstream is (path, std::ios::binary);
+		is.read (reinterpret_cast<char *> (&header), sizeof(header));
+		if (!is || memcmp (header.magic, checkpoint_magic, sizeof(header.magic)) != 0 ||
+			header.version != checkpoint_version)
+		{
+			clog << path << ": not a checkpoint, or another version\n";
+			return false;
+		}
+	}
+	if (header.board != board_hash (search.spin_op[1]))
+	{
+		clog << path << ": checkpoint of another board\n";
+		return false;
+	}
+
+	GraphFile graph;
+	if (!graph.open (path, sizeof(header)))
+		return false;
+	if (graph.header().root >= graph.size())
+	{
+		clog << path << ": checkpoint has no root\n";
+		return false;
+	}
+	if (!valid_edges (graph))
+	{
+		clog << path << ": corrupt checkpoint\n";
+		return false;
+	}
+
+	std::vector<Node *> nodes (graph.size());
+	for (uint64_t n = 0; n < graph.size(); ++n)
+	{
+		const GraphNodeRecord& r = graph.nodes()[n];
+		State state = graph.state (n);
+		if (r.kind == GRAPH_SPIN)
+			nodes[n] = cache.create_spin_node (state);
+		else if (r.kind == GRAPH_DECIDE)
+			nodes[n] = cache.create_decide_node (state);
+		else
+			nodes[n] = cache.create_terminal_node (state);
+		if (r.has_payoff)
+			for (int p = 0; p < num_players; ++p)
+				nodes[n]->payoff_.assign (p, r.payoff[p]);
+		nodes[n]->frozen(r.flags & GRAPH_FROZEN);
+	}
+
+	auto target = [&] (const GraphEdgeRecord& e) {
+		Node *node = e.target != GraphNoNode ? nodes[e.target] : nullptr;
+		if (node)
+			node->link();
+		return node;
+	};
+	for (uint64_t n = 0; n < graph.size(); ++n)
+	{
+		const GraphEdgeRecord *begin = graph.edges() + graph.offsets()[n];
+		const GraphEdgeRecord *end = graph.edges() + graph.offsets()[n + 1];
+		if (graph.nodes()[n].kind == GRAPH_SPIN)
+		{
+			SpinNode *node = static_cast<SpinNode *> (nodes[n]);
+			node->branches.reserve (end - begin);
+			for (const GraphEdgeRecord *e = begin; e != end; ++e)
+				node->branches.emplace_back (e->prob, target (*e));
+		}
+		else if (graph.nodes()[n].kind == GRAPH_DECIDE)
+		{
+			DecideNode *node = static_cast<DecideNode *> (nodes[n]);
+			node->if_play = target (begin[0]);
+			node->if_pass = target (begin[1]);
+		}
+	}
+
+	root = graph.state (graph.header().root);
+	depth = header.depth;
+	return true;
+}
+
+CheckpointWriter::CheckpointWriter (const std::string& path) :
+	path_(path)
+{
+}
+
+CheckpointWriter::~CheckpointWriter ()
+{
+	reap (true);
+}
+
+/**
+ * Fork a child that serializes the graph from its snapshot of memory and
+ * writes it.  Pending output is flushed first, so that the child does not
+ * write it a second time.  The child leaves with _exit, which runs no
+ * destructors or exit handlers of the parent's state.
+ */
+bool CheckpointWriter::submit (const Search& search, const Node *root, int depth)
+{
+	if (!reap (false))
+		return false;
+	clog.flush ();
+	pid_t pid = fork ();
+	if (pid < 0)
+	{
+		clog << path_ << ": cannot fork to write checkpoint\n";
+		return false;
+	}
+	if (pid == 0)
+	{
+		bool ok = write (make_checkpoint (search, root, depth));
+		clog.flush ();
+		_exit (ok ? 0 : 1);
+	}
+	child_ = pid;
+	return true;
+}
+
+bool CheckpointWriter::reap (bool wait)
+{
+	if (child_ < 0)
+		return true;
+	int status;
+	pid_t pid;
+	do
+		pid = waitpid (child_, &status, wait ? 0 : WNOHANG);
+	while (pid < 0 && errno == EINTR);
+	if (pid == 0)
+		return false;
+	if (pid == child_ && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		written_++;
+	child_ = -1;
+	return true;
+}
+
+bool CheckpointWriter::write (const std::string& data) const
+{
+	std::string tmp = path_ + ".tmp";
+	int fd = ::open (tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		clog << tmp << ": cannot create\n";
+		return false;
+	}
+	size_t done = 0;
+	while (done < data.size())
+	{
+		ssize_t n = ::write (fd, data.data() + done, data.size() - done);
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	bool ok = done == data.size() && fsync (fd) == 0;
+	ok = (close (fd) == 0) && ok;
+	if (!ok || rename (tmp.c_str(), path_.c_str()) != 0)
+	{
+		clog << path_ << ": cannot write checkpoint\n";
+		unlink (tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
+} // namespace pyl
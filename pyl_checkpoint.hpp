@@ -0,0 +1,85 @@
+#ifndef __PYL_CHECKPOINT_H
+#define __PYL_CHECKPOINT_H
+
+#include <cstdint>
+#include <string>
+
+#include <sys/types.h>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * Checkpoints of a long-running search.
+ *
+ * A checkpoint is a CheckpointHeader followed by the whole graph in the
+ * format of write_graph (pyl_graph.hpp): every node with its payoff and
+ * its edges.  The frontier needs no list of its own, as it is the spin
+ * nodes without branches and the decide nodes without either choice,
+ * which the next scan expands.  The header records the depth of the last
+ * completed iteration, so that a resumed search continues with the next
+ * one, and the board, so that a checkpoint is not resumed with another.
+ *
+ * Serializing the graph takes time in proportion to its size, so it is
+ * not done by the search: CheckpointWriter forks between iterations, and
+ * the child serializes and writes its copy-on-write snapshot of the graph
+ * while the next iteration runs.  The search pauses only for the fork,
+ * which copies the page tables; the pages it then modifies are copied as
+ * it touches them.
+ */
+struct CheckpointHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t depth;
+	uint64_t board;
+};
+
+/* Serialize the graph of a search with the given root, after an iteration
+to depth */
+std::string make_checkpoint (const Search& search, const Node *root, int depth);
+
+/* Load a checkpoint into search, whose node cache must be empty.  Sets root
+and depth from the file.  Returns false, with a message on clog, if the file
+cannot be read or was written for another board. */
+bool load_checkpoint (Search& search, const std::string& path, State& root, int& depth);
+
+/*
+ * CheckpointWriter - writes checkpoints to a file from a forked child.
+ *
+ * Each checkpoint is written to path.tmp, synced, and renamed over path,
+ * so that path always holds a complete checkpoint even if the process is
+ * killed while writing.  If the search submits a checkpoint while the
+ * child writing the previous one is still running, the new one is
+ * skipped.
+ */
+struct CheckpointWriter
+{
+	explicit CheckpointWriter (const std::string& path);
+	/* Waits for the checkpoint being written */
+	~CheckpointWriter ();
+	CheckpointWriter (const CheckpointWriter&) = delete;
+	CheckpointWriter& operator= (const CheckpointWriter&) = delete;
+
+	/* Start writing a checkpoint of search with the given root, after an
+	iteration to depth.  Returns false if it was skipped. */
+	bool submit (const Search& search, const Node *root, int depth);
+
+	/* Number of checkpoints known to be written so far */
+	size_t written () const { return written_; }
+
+private:
+	/* Collect the child, waiting for it if wait is set.  Returns false if
+	it is still running. */
+	bool reap (bool wait);
+	bool write (const std::string& data) const;
+
+	const std::string path_;
+	pid_t child_ = -1;
+	size_t written_ = 0;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_CHECKPOINT_H */
@@ -0,0 +1,253 @@
+
+#include <cstring>
+#include <deque>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pyl_graph.hpp"
+
+namespace pyl {
+
+namespace {
+
+const char graph_magic[8] = { 'P', 'Y', 'L', 'G', 'R', 'A', 'P', 'H' };
+const uint32_t graph_version = 2;
+
+GraphNodeKind kind_of (const Node *node)
+{
+	if (node->kind() == NODE_SPIN)
+		return GRAPH_SPIN;
+	if (node->kind() == NODE_DECIDE)
+		return GRAPH_DECIDE;
+	return GRAPH_TERMINAL;
+}
+
+uint64_t edge_count (const Node *node, GraphNodeKind kind)
+{
+	if (kind == GRAPH_SPIN)
+		return static_cast<const SpinNode *> (node)->branches.size();
+	return kind == GRAPH_DECIDE ? 2 : 0;
+}
+
+template <class T>
+void put (std::ostream& os, const T& value)
+{
+	os.write (reinterpret_cast<const char *> (&value), sizeof(value));
+}
+
+/* Check that the edge offsets of a mapped graph increase and stay within
+its edge table, and that the root and every edge target is a node or
+GraphNoNode.  Readers index the mapping with these numbers, so a corrupt
+file must be rejected rather than read out of bounds. */
+bool valid_layout (const GraphHeader& header, const uint64_t *offsets, const GraphEdgeRecord *edges)
+{
+	if (offsets[0] != 0 || offsets[header.node_count] != header.edge_count)
+		return false;
+	for (uint64_t n = 0; n < header.node_count; ++n)
+		if (offsets[n + 1] < offsets[n])
+			return false;
+	for (uint64_t e = 0; e < header.edge_count; ++e)
+		if (edges[e].target >= header.node_count && edges[e].target != GraphNoNode)
+			return false;
+	return header.root < header.node_count || header.root == GraphNoNode;
+}
+
+} // namespace
+
+/**
+ * Write the graph in four passes over the node cache: number the nodes,
+ * then write the edge offsets, the node records and the edges.
+ */
+bool write_graph (std::ostream& os, const Search& search, const Node *root)
+{
+	NodeCache& cache = *search.node_cache_;
+	std::unordered_map<const Node *, uint32_t> index;
+	index.reserve (cache.size());
+	uint64_t edges = 0;
+	cache.apply ([&] (Node *node) {
+		index.emplace (node, uint32_t(index.size()));
+		edges += edge_count (node, kind_of (node));
+	});
+	auto index_of = [&index] (const Node *node) {
+		auto it = index.find (node);
+		return it != index.end() ? it->second : GraphNoNode;
+	};
+
+	GraphHeader header{};
+	memcpy (header.magic, graph_magic, sizeof(header.magic));
+	header.version = graph_version;
+	header.node_size = sizeof(GraphNodeRecord);
+	header.edge_size = sizeof(GraphEdgeRecord);
+	header.root = index_of (root);
+	header.node_count = index.size();
+	header.edge_count = edges;
+	put (os, header);
+
+	uint64_t offset = 0;
+	put (os, offset);
+	cache.apply ([&] (Node *node) {
+		offset += edge_count (node, kind_of (node));
+		put (os, offset);
+	});
+
+	cache.apply ([&] (Node *node) {
+		GraphNodeRecord r{};
+		memcpy (r.state, &node->state, sizeof(r.state));
+		r.kind = kind_of (node);
+		r.has_payoff = !node->payoff_.is_null();
+		r.flags = node->frozen() ? GRAPH_FROZEN : 0;
+		if (r.has_payoff)
+			for (int n = 0; n < num_players; ++n)
+				r.payoff[n] = node->payoff_[n];
+		put (os, r);
+	});
+
+	cache.apply ([&] (Node *node) {
+		GraphNodeKind kind = kind_of (node);
+		if (kind == GRAPH_SPIN)
+		{
+			for (const auto& branch : static_cast<const SpinNode *> (node)->branches)
+				put (os, GraphEdgeRecord{ index_of (branch.second), branch.first });
+		}
+		else if (kind == GRAPH_DECIDE)
+		{
+			const DecideNode *d = static_cast<const DecideNode *> (node);
+			put (os, GraphEdgeRecord{ index_of (d->if_play), 1.0 });
+			put (os, GraphEdgeRecord{ index_of (d->if_pass), 1.0 });
+		}
+	});
+	return bool(os);
+}
+
+GraphFile::~GraphFile ()
+{
+	if (map_)
+		munmap (map_, map_size_);
+}
+
+bool GraphFile::open (const std::string& path, size_t offset)
+{
+	int fd = ::open (path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		clog << path << ": cannot open\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat (fd, &st) < 0 || size_t(st.st_size) < offset + sizeof(GraphHeader))
+	{
+		close (fd);
+		clog << path << ": not a graph file\n";
+		return false;
+	}
+	void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+	{
+		clog << path << ": cannot map\n";
+		return false;
+	}
+
+	/* Bound the counts by the file size before multiplying, so that the
+	size they imply cannot wrap around on a crafted header */
+	const GraphHeader *header = reinterpret_cast<const GraphHeader *> (static_cast<const char *> (map) + offset);
+	size_t size = st.st_size;
+	bool counts_fit = header->node_count < size / sizeof(GraphNodeRecord) &&
+		header->edge_count <= size / sizeof(GraphEdgeRecord);
+	size_t expected = !counts_fit ? 0 : offset + sizeof(GraphHeader) + (header->node_count + 1) * sizeof(uint64_t) +
+		header->node_count * sizeof(GraphNodeRecord) + header->edge_count * sizeof(GraphEdgeRecord);
+	if (memcmp (header->magic, graph_magic, sizeof(header->magic)) != 0 ||
+		header->version != graph_version ||
+		header->node_size != sizeof(GraphNodeRecord) ||
+		header->edge_size != sizeof(GraphEdgeRecord) ||
+		!counts_fit || size != expected)
+	{
+		munmap (map, st.st_size);
+		clog << path << ": not a graph file, or another version\n";
+		return false;
+	}
+	const uint64_t *offsets = reinterpret_cast<const uint64_t *> (header + 1);
+	const GraphNodeRecord *nodes = reinterpret_cast<const GraphNodeRecord *> (offsets + header->node_count + 1);
+	const GraphEdgeRecord *edges = reinterpret_cast<const GraphEdgeRecord *> (nodes + header->node_count);
+	if (!valid_layout (*header, offsets, edges))
+	{
+		munmap (map, st.st_size);
+		clog << path << ": corrupt graph file\n";
+		return false;
+	}
+
+	if (map_)
+		munmap (map_, map_size_);
+	map_ = map;
+	map_size_ = st.st_size;
+	header_ = header;
+	offsets_ = offsets;
+	nodes_ = nodes;
+	edges_ = edges;
+	return true;
+}
+
+State GraphFile::state (uint64_t n) const
+{
+	State res;
+	memcpy (&res, nodes_[n].state, sizeof(res));
+	return res;
+}
+
+void write_dot (std::ostream& os, const Node *root, int max_depth, Prob min_prob)
+{
+	struct Item
+	{
+		const Node *node;
+		int depth;
+		Prob prob;
+	};
+	static const char *shape[] = { "box", "diamond", "ellipse" };
+
+	std::unordered_map<const Node *, uint32_t> id;
+	std::deque<Item> queue;
+	auto reach = [&] (const Node *node, int depth, Prob prob) -> bool {
+		if (!node || depth > max_depth || prob < min_prob)
+			return false;
+		if (id.count (node))
+			return true;
+		uint32_t n = id.size();
+		id.emplace (node, n);
+		os << "  n" << n << " [shape=" << shape[kind_of (node)] <<
+			", label=\"" << node->state << "\\n" << node->payoff_ << "\"];\n";
+		queue.push_back (Item{ node, depth, prob });
+		return true;
+	};
+
+	os << "digraph pyl {\n";
+	reach (root, 0, 1.0);
+	while (!queue.empty())
+	{
+		Item item = queue.front();
+		queue.pop_front();
+		uint32_t from = id[item.node];
+		GraphNodeKind kind = kind_of (item.node);
+		if (kind == GRAPH_SPIN)
+		{
+			for (const auto& branch : static_cast<const SpinNode *> (item.node)->branches)
+				if (reach (branch.second, item.depth + 1, item.prob * branch.first))
+					os << "  n" << from << " -> n" << id[branch.second] <<
+						" [label=\"" << branch.first << "\"];\n";
+		}
+		else if (kind == GRAPH_DECIDE)
+		{
+			const DecideNode *d = static_cast<const DecideNode *> (item.node);
+			if (reach (d->if_play, item.depth + 1, item.prob))
+				os << "  n" << from << " -> n" << id[d->if_play] << " [label=\"play\"];\n";
+			if (reach (d->if_pass, item.depth + 1, item.prob))
+				os << "  n" << from << " -> n" << id[d->if_pass] << " [label=\"pass\"];\n";
+		}
+	}
+	os << "}\n";
+}
+
+} // namespace pyl
@@ -0,0 +1,109 @@
+#ifndef __PYL_GRAPH_H
+#define __PYL_GRAPH_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * Binary graph export.
+ *
+ * The file is a GraphHeader, then node_count+1 edge offsets (uint64_t),
+ * then one GraphNodeRecord per node, then the edges in CSR form: the edges
+ * of node n are edges[offset[n]] up to edges[offset[n+1]].  Nodes are
+ * numbered in NodeCache::apply order.
+ *
+ * A spin node has one edge per branch, weighted by its probability.  A
+ * decide node always has two edges, play then pass, with probability 1;
+ * a choice that was never created has target GraphNoNode.  A terminal
+ * node has no edges.  A frozen node has GRAPH_FROZEN in its flags; a
+ * frozen spin node has no edges either.
+ *
+ * The writer streams the three tables straight from the NodeCache; the
+ * only extra memory is a map from node to index.  GraphFile maps a file
+ * read-only, so a reader needs no parsing.
+ */
+enum GraphNodeKind : uint8_t { GRAPH_TERMINAL, GRAPH_DECIDE, GRAPH_SPIN };
+enum GraphNodeFlags : uint16_t { GRAPH_FROZEN = 1 };
+
+constexpr uint32_t GraphNoNode = ~uint32_t(0);
+
+struct GraphHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t node_size;
+	uint32_t edge_size;
+	uint32_t root;
+	uint64_t node_count;
+	uint64_t edge_count;
+};
+
+struct GraphNodeRecord
+{
+	uint32_t state[3];
+	uint8_t kind;
+	uint8_t has_payoff;
+	uint16_t flags;  /* GraphNodeFlags */
+	float payoff[3];
+};
+static_assert (sizeof(GraphNodeRecord) == 28, "GraphNodeRecord should be 28 bytes");
+static_assert (sizeof(State) == sizeof(GraphNodeRecord::state), "State does not fit a GraphNodeRecord");
+
+struct GraphEdgeRecord
+{
+	uint32_t target;
+	float prob;
+};
+
+/* Write every node of the search, with root as the header's root.
+Returns false on a write error. */
+bool write_graph (std::ostream& os, const Search& search, const Node *root);
+
+/*
+ * GraphFile - a graph file mapped read-only.
+ */
+struct GraphFile
+{
+	GraphFile () = default;
+	~GraphFile ();
+	GraphFile (const GraphFile&) = delete;
+	GraphFile& operator= (const GraphFile&) = delete;
+
+	/* Map a file, reporting any error to clog.  Returns false on error.
+	The graph starts offset bytes into the file. */
+	bool open (const std::string& path, size_t offset = 0);
+
+	const GraphHeader& header () const { return *header_; }
+	uint64_t size () const { return header_->node_count; }
+	const GraphNodeRecord *nodes () const { return nodes_; }
+	const uint64_t *offsets () const { return offsets_; }
+	const GraphEdgeRecord *edges () const { return edges_; }
+
+	State state (uint64_t n) const;
+
+private:
+	void *map_ = nullptr;
+	size_t map_size_ = 0;
+	const GraphHeader *header_ = nullptr;
+	const GraphNodeRecord *nodes_ = nullptr;
+	const uint64_t *offsets_ = nullptr;
+	const GraphEdgeRecord *edges_ = nullptr;
+};
+
+/*
+ * Write the part of the graph below root in Graphviz DOT format, breadth
+ * first.  A node is included if it is at most max_depth edges from root,
+ * and the product of the branch probabilities on the path by which it was
+ * first reached is at least min_prob.  Nodes are written as they are
+ * reached, so the output can be piped to dot directly.
+ */
+void write_dot (std::ostream& os, const Node *root, int max_depth, Prob min_prob);
+
+} // namespace pyl
+
+#endif /* __PYL_GRAPH_H */
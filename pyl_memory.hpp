@@ -0,0 +1,178 @@
+#ifndef __PYL_MEMORY_H
+#define __PYL_MEMORY_H
+
+#include <cstddef>
+#include <new>
+#include <ostream>
+
+namespace pyl {
+
+/*
+ * Memory accounting.
+ *
+ * Each of the large data structures used by a search is assigned to a
+ * category, and all of its allocations are counted there.  Live bytes,
+ * live allocation count, and the peak number of bytes are kept for each
+ * category, plus a peak for the total across all categories.
+ *
+ * The counters are plain integers, not atomics: the search is single
+ * threaded.
+ */
+enum MemoryCategory
+{
+	MEM_NODES,       /* SpinNode, DecideNode, TerminalNode objects */
+	MEM_BRANCHES,    /* SpinNode::branches vectors */
+	MEM_BUCKETS,     /* NodeCache hash tables: bucket arrays and entries */
+	MEM_SPIN_TABLES, /* SpinOperator tables, including all powers */
+	MEM_CATEGORIES
+};
+
+struct MemoryUsage
+{
+	size_t bytes = 0;
+	size_t count = 0;
+	size_t peak_bytes = 0;
+};
+
+struct MemoryStats
+{
+	static inline MemoryUsage usage[MEM_CATEGORIES];
+	static inline size_t total_bytes = 0;
+	static inline size_t peak_bytes = 0;
+
+	static void add (MemoryCategory cat, size_t bytes)
+	{
+		MemoryUsage& u = usage[cat];
+		u.bytes += bytes;
+		u.count++;
+		if (u.bytes > u.peak_bytes)
+			u.peak_bytes = u.bytes;
+		total_bytes += bytes;
+		if (total_bytes > peak_bytes)
+			peak_bytes = total_bytes;
+	}
+
+	static void remove (MemoryCategory cat, size_t bytes)
+	{
+		MemoryUsage& u = usage[cat];
+		u.bytes -= bytes;
+		u.count--;
+		total_bytes -= bytes;
+	}
+
+	/* Restart peak tracking from the current live values, e.g. at the
+	start of a new search. */
+	static void reset_peak ()
+	{
+		for (auto& u : usage)
+			u.peak_bytes = u.bytes;
+		peak_bytes = total_bytes;
+	}
+
+	static const char *name (MemoryCategory cat);
+	static void print (std::ostream& os);
+};
+
+/*
+ * PageHeap - storage for the nodes, branch arrays and hash tables of a
+ * search, which are touched at random and so suffer most from TLB misses.
+ *
+ * Memory is mapped in large chunks, trying in turn explicit huge pages
+ * (MAP_HUGETLB, which need pages reserved in vm.nr_hugepages), transparent
+ * huge pages (madvise MADV_HUGEPAGE on a 2 MB aligned mapping), and normal
+ * pages.  Once a kind of mapping fails it is not tried again.  Small blocks
+ * are carved from the chunks by size class and kept on a free list per
+ * class when released; chunks are not returned to the system.  Blocks
+ * larger than LargeSize get a mapping of their own.
+ *
+ * Blocks must be released with the size they were allocated with.  Like
+ * MemoryStats, the heap is not thread safe.
+ */
+enum PageKind { PAGES_NORMAL, PAGES_TRANSPARENT, PAGES_EXPLICIT };
+
+struct PageHeap
+{
+	static constexpr size_t HugePageSize = size_t(2) << 20;
+	static constexpr size_t ChunkSize = size_t(32) << 20;
+	static constexpr size_t LargeSize = size_t(256) << 10;
+
+	static void *allocate (size_t bytes);
+	static void deallocate (void *p, size_t bytes);
+
+	/* The kind and size of the largest pages obtained so far */
+	static PageKind kind () { return kind_; }
+	static size_t page_size ();
+	static size_t mapped_bytes () { return mapped_bytes_; }
+	/* "normal", "transparent" or "explicit" */
+	static const char *kind_name (PageKind kind);
+
+	/* Print the page size, the bytes mapped, and how many of them the
+	kernel reports as transparent huge pages */
+	static void print (std::ostream& os);
+
+private:
+	/* 8 to 64 bytes in steps of 8, then four classes per power of two
+	up to LargeSize */
+	static constexpr int SmallClasses = 8;
+	static constexpr int Classes = SmallClasses + 4 * 12;
+
+	static int size_class (size_t bytes);
+	static size_t class_size (int c);
+	static size_t large_size (size_t bytes);
+	static void *map (size_t bytes);
+
+	struct FreeBlock { FreeBlock *next; };
+	static inline FreeBlock *free_[Classes] = {};
+	static inline char *next_ = nullptr;
+	static inline char *end_ = nullptr;
+	static inline PageKind kind_ = PAGES_NORMAL;
+	static inline bool explicit_failed_ = false;
+	static inline bool transparent_failed_ = false;
+	static inline size_t mapped_bytes_ = 0;
+};
+
+/*
+ * TrackingAllocator - a std::allocator that charges every allocation to
+ * a memory category.  This is used for the containers inside the search
+ * data structures, so that the container overhead (hash buckets, vector
+ * slack) is counted along with the elements.  The branch arrays and the
+ * node cache's tables are placed on the PageHeap.
+ */
+template <class T, MemoryCategory C>
+struct TrackingAllocator
+{
+	typedef T value_type;
+
+	template <class U> struct rebind { typedef TrackingAllocator<U, C> other; };
+
+	TrackingAllocator () = default;
+	template <class U> TrackingAllocator (const TrackingAllocator<U, C>&) {}
+
+	static constexpr bool Paged = (C == MEM_BRANCHES || C == MEM_BUCKETS);
+
+	T *allocate (size_t n)
+	{
+		MemoryStats::add (C, n * sizeof(T));
+		if (Paged)
+			return static_cast<T *> (PageHeap::allocate (n * sizeof(T)));
+		return static_cast<T *> (::operator new (n * sizeof(T)));
+	}
+
+	void deallocate (T *p, size_t n)
+	{
+		MemoryStats::remove (C, n * sizeof(T));
+		if (Paged)
+			PageHeap::deallocate (p, n * sizeof(T));
+		else
+			::operator delete (p);
+	}
+
+	template <class U>
+	bool operator== (const TrackingAllocator<U, C>&) const { return true; }
+	template <class U>
+	bool operator!= (const TrackingAllocator<U, C>&) const { return false; }
+};
+
+} // namespace pyl
+
+#endif /* __PYL_MEMORY_H */
@@ -0,0 +1,162 @@
+
+#include "pyl_perf.hpp"
+
+#ifdef PYL_PERF
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <iomanip>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+namespace pyl {
+
+namespace {
+
+/* The counters are opened as one group led by the cycle counter, so a
+single read() returns a consistent sample of all of them. */
+struct CounterGroup
+{
+	int fd[PERF_COUNTERS];
+	bool open = false;
+	bool tried = false;
+
+	uint64_t last[PERF_COUNTERS] = {};
+	uint64_t total[PERF_REGIONS][PERF_COUNTERS];
+	uint64_t calls[PERF_REGIONS];
+	std::vector<PerfRegion> stack;
+
+	~CounterGroup ()
+	{
+		if (open)
+			for (int fd_n : fd)
+				close (fd_n);
+	}
+
+	bool start ()
+	{
+		if (tried)
+			return open;
+		tried = true;
+
+		static const uint64_t config[PERF_COUNTERS] = {
+			PERF_COUNT_HW_CPU_CYCLES,
+			PERF_COUNT_HW_INSTRUCTIONS,
+			PERF_COUNT_HW_CACHE_MISSES,
+			PERF_COUNT_HW_BRANCH_MISSES,
+		};
+
+		for (int n = 0; n < PERF_COUNTERS; ++n)
+		{
+			struct perf_event_attr attr;
+			memset (&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = config[n];
+			attr.read_format = PERF_FORMAT_GROUP;
+			attr.disabled = (n == 0);
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			int group = (n == 0) ? -1 : fd[0];
+			fd[n] = syscall (__NR_perf_event_open, &attr, 0, -1, group, 0);
+			if (fd[n] < 0)
+			{
+				while (--n >= 0)
+					close (fd[n]);
+				return false;
+			}
+		}
+
+		ioctl (fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl (fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		open = true;
+		clear ();
+		sample (PERF_OTHER);
+		return true;
+	}
+
+	void clear ()
+	{
+		memset (total, 0, sizeof(total));
+		memset (calls, 0, sizeof(calls));
+	}
+
+	/* Read the group and charge the counts since the previous read to
+	the given region. */
+	void sample (PerfRegion region)
+	{
+		struct { uint64_t nr; uint64_t values[PERF_COUNTERS]; } data;
+		if (read (fd[0], &data, sizeof(data)) != sizeof(data))
+			return;
+		for (int n = 0; n < PERF_COUNTERS; ++n)
+		{
+			total[region][n] += data.values[n] - last[n];
+			last[n] = data.values[n];
+		}
+	}
+
+	PerfRegion current () const { return stack.empty() ? PERF_OTHER : stack.back(); }
+};
+
+CounterGroup group;
+
+const char *region_name[PERF_REGIONS] = {
+	"other", "scan_branches", "calc_payoff", "create_node", "spin_operator",
+};
+
+} // namespace
+
+void PerfCounters::enter (PerfRegion region)
+{
+	if (!group.start ())
+		return;
+	group.sample (group.current ());
+	group.stack.push_back (region);
+	group.calls[region]++;
+}
+
+void PerfCounters::leave ()
+{
+	if (!group.open)
+		return;
+	group.sample (group.current ());
+	group.stack.pop_back ();
+}
+
+void PerfCounters::reset ()
+{
+	if (!group.start ())
+		return;
+	group.sample (group.current ());
+	group.clear ();
+}
+
+void PerfCounters::print (std::ostream& os)
+{
+	if (!group.start ())
+	{
+		os << "   perf: counters unavailable\n";
+		return;
+	}
+	group.sample (group.current ());
+
+	os << "   perf: " << std::setw(14) << "region" << std::setw(10) << "calls" <<
+		std::setw(14) << "cycles" << std::setw(14) << "instructions" <<
+		std::setw(12) << "llc-miss" << std::setw(12) << "br-miss" << '\n';
+	for (int r = 0; r < PERF_REGIONS; ++r)
+	{
+		const uint64_t *t = group.total[r];
+		os << "         " << std::setw(14) << region_name[r] <<
+			std::setw(10) << group.calls[r] <<
+			std::setw(14) << t[PERF_CYCLES] << std::setw(14) << t[PERF_INSTRUCTIONS] <<
+			std::setw(12) << t[PERF_LLC_MISSES] << std::setw(12) << t[PERF_BRANCH_MISSES] << '\n';
+	}
+}
+
+} // namespace pyl
+
+#endif /* PYL_PERF */
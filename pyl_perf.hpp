@@ -0,0 +1,66 @@
+#ifndef __PYL_PERF_H
+#define __PYL_PERF_H
+
+#include <ostream>
+
+namespace pyl {
+
+/*
+ * Hardware performance counters (Linux only).
+ *
+ * Build with PERF=y (which defines PYL_PERF) to enable.  Code regions are
+ * marked with PERF_SCOPE(region); each marker reads the counter group on
+ * entry and exit and charges the difference to the innermost active
+ * region, so the reported figures are exclusive ("self") counts.  When
+ * PYL_PERF is not defined, PERF_SCOPE expands to nothing.
+ */
+enum PerfRegion
+{
+	PERF_OTHER,          /* anything not inside a marked region */
+	PERF_SCAN_BRANCHES,
+	PERF_CALC_PAYOFF,
+	PERF_CREATE_NODE,
+	PERF_SPIN_OPERATOR,  /* composing SpinOperator powers */
+	PERF_REGIONS
+};
+
+enum PerfCounter
+{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES,
+	PERF_COUNTERS
+};
+
+#ifdef PYL_PERF
+
+struct PerfCounters
+{
+	static void enter (PerfRegion region);
+	static void leave ();
+
+	/* Zero all accumulated counts, e.g. at the start of a search */
+	static void reset ();
+	static void print (std::ostream& os);
+};
+
+struct PerfScope
+{
+	explicit PerfScope (PerfRegion region) { PerfCounters::enter (region); }
+	~PerfScope () { PerfCounters::leave (); }
+	PerfScope (const PerfScope&) = delete;
+	PerfScope& operator= (const PerfScope&) = delete;
+};
+
+#define PERF_SCOPE(region) PerfScope perf_scope_(region)
+
+#else
+
+#define PERF_SCOPE(region)
+
+#endif /* PYL_PERF */
+
+} // namespace pyl
+
+#endif /* __PYL_PERF_H */
@@ -0,0 +1,54 @@
+
+#include <iomanip>
+
+#include "pyl_profile.hpp"
+
+namespace pyl {
+
+uint32_t HotStateProfiler::state_class (const State& ds)
+{
+	int gap = ds.const_up().score - std::max (ds.const_opponent(0).score, ds.const_opponent(1).score);
+	int bucket = (gap >= 0) ? gap / ScoreGapBucket : -((-gap + ScoreGapBucket - 1) / ScoreGapBucket);
+	return (uint32_t(ds.total_spins()) << 16) | uint32_t(bucket + 0x8000);
+}
+
+void HotStateProfiler::sample (const State& ds)
+{
+	states_.add (ds);
+	classes_.add (state_class (ds));
+}
+
+/**
+ * Print the most frequently sampled states and state classes.  Counts
+ * are of samples; multiply by the sample rate to estimate lookups.
+ */
+void HotStateProfiler::print (std::ostream& os, size_t count) const
+{
+	os.setf (ios::fixed, ios::floatfield);
+	os.precision (2);
+
+	uint64_t total = states_.total ();
+	os << "Hot states (" << total << " samples, 1 in " << sample_rate_ << " lookups):\n";
+	auto states = states_.top ();
+	for (size_t n = 0; n < states.size () && n < count; ++n)
+	{
+		const auto& c = states[n];
+		os << std::setw(10) << c.count << " +/-" << std::setw(8) << c.error <<
+			std::setw(7) << 100.0 * c.count / total << "% " << c.key << '\n';
+	}
+
+	os << "Hot state classes (spins, lead):\n";
+	auto classes = classes_.top ();
+	for (size_t n = 0; n < classes.size () && n < count; ++n)
+	{
+		const auto& c = classes[n];
+		int spins = c.key >> 16;
+		int bucket = int(c.key & 0xffff) - 0x8000;
+		os << std::setw(10) << c.count << " +/-" << std::setw(8) << c.error <<
+			std::setw(7) << 100.0 * c.count / total << "% " <<
+			"spins " << std::setw(2) << spins << " lead [" << bucket * ScoreGapBucket <<
+			',' << (bucket + 1) * ScoreGapBucket << ")\n";
+	}
+}
+
+} // namespace pyl
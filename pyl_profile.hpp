@@ -0,0 +1,119 @@
+#ifndef __PYL_PROFILE_H
+#define __PYL_PROFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+#include "pyl.hpp"
+
+namespace pyl {
+
+/*
+ * SpaceSaving - heavy hitters sketch (Metwally et al.) with a fixed number
+ * of counters.  Every key with a true frequency above N/capacity is
+ * guaranteed to be present.  A reported count overestimates the true
+ * count by at most its error field.
+ */
+template <class Key>
+struct SpaceSaving
+{
+	struct Counter
+	{
+		Key key;
+		uint64_t count;
+		uint64_t error;
+	};
+
+	explicit SpaceSaving (size_t capacity) : capacity_(capacity)
+	{
+		counters_.reserve (capacity);
+		index_.reserve (capacity);
+	}
+
+	void add (const Key& key)
+	{
+		total_++;
+		auto it = index_.find (key);
+		if (it != index_.end ())
+		{
+			counters_[it->second].count++;
+			return;
+		}
+		if (counters_.size () < capacity_)
+		{
+			index_[key] = counters_.size ();
+			counters_.push_back (Counter{key, 1, 0});
+			return;
+		}
+		/* Evict the smallest counter, and let the new key inherit its
+		count as the error bound. */
+		auto min = std::min_element (counters_.begin (), counters_.end (),
+			[] (const Counter& c1, const Counter& c2) { return c1.count < c2.count; });
+		index_.erase (min->key);
+		index_[key] = min - counters_.begin ();
+		*min = Counter{key, min->count + 1, min->count};
+	}
+
+	/* Return the counters, most frequent first */
+	std::vector<Counter> top () const
+	{
+		std::vector<Counter> res (counters_);
+		std::sort (res.begin (), res.end (),
+			[] (const Counter& c1, const Counter& c2) { return c1.count > c2.count; });
+		return res;
+	}
+
+	uint64_t total () const { return total_; }
+
+private:
+	size_t capacity_;
+	uint64_t total_ = 0;
+	std::vector<Counter> counters_;
+	std::unordered_map<Key, size_t> index_;
+};
+
+/*
+ * HotStateProfiler - samples every Nth state looked up through
+ * NodeCache::create_node, and keeps heavy hitter sketches of individual
+ * states and of state classes.  A class is the total number of spins left
+ * together with the lead of the player up over the best opponent,
+ * bucketed to ScoreGapBucket.
+ */
+struct HotStateProfiler
+{
+	static constexpr int ScoreGapBucket = 1000;
+
+	explicit HotStateProfiler (unsigned int sample_rate, size_t capacity = 256) :
+		sample_rate_(sample_rate), countdown_(sample_rate),
+		states_(capacity), classes_(capacity)
+	{
+	}
+
+	void lookup (const State& ds)
+	{
+		if (--countdown_ == 0)
+		{
+			countdown_ = sample_rate_;
+			sample (ds);
+		}
+	}
+
+	void sample (const State& ds);
+	void print (std::ostream& os, size_t count = 20) const;
+
+	/* A state class is packed as (total spins << 16) | (gap bucket + 0x8000) */
+	static uint32_t state_class (const State& ds);
+
+private:
+	unsigned int sample_rate_;
+	unsigned int countdown_;
+	SpaceSaving<State> states_;
+	SpaceSaving<uint32_t> classes_;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_PROFILE_H */
@@ -0,0 +1,167 @@
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "pyl_results.hpp"
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+namespace {
+
+const char results_magic[8] = { 'P', 'Y', 'L', 'R', 'S', 'L', 'T', 'S' };
+const uint32_t results_version = 1;
+
+const char *decision_name (uint8_t decision)
+{
+	switch (decision)
+	{
+		case DecideNode::PLAY: return "play";
+		case DecideNode::PASS: return "pass";
+		default: return "undecided";
+	}
+}
+
+} // namespace
+
+ResultFormat result_format (const std::string& path)
+{
+	const std::string csv = ".csv";
+	if (path.size () >= csv.size () && path.compare (path.size () - csv.size (), csv.size (), csv) == 0)
+		return RESULTS_CSV;
+	return RESULTS_BINARY;
+}
+
+bool read_results (const std::string& path, std::vector<ResultRecord>& records)
+{
+	std::ifstream is (path, std::ios::binary);
+	ResultHeader header{};
+	is.read (reinterpret_cast<char *> (&header), sizeof(header));
+	if (!is || memcmp (header.magic, results_magic, sizeof(header.magic)) != 0 ||
+		header.version != results_version || header.record_size != sizeof(ResultRecord))
+	{
+		clog << path << ": not a results file, or another version\n";
+		return false;
+	}
+	ResultRecord record;
+	while (is.read (reinterpret_cast<char *> (&record), sizeof(record)))
+		records.push_back (record);
+	return true;
+}
+
+ResultSink::ResultSink (const std::string& path, ResultFormat format) :
+	path_(path), format_(format),
+	os_(path, format == RESULTS_BINARY ? std::ios::binary : std::ios::out)
+{
+	if (format_ == RESULTS_BINARY)
+	{
+		ResultHeader header{};
+		memcpy (header.magic, results_magic, sizeof(header.magic));
+		header.version = results_version;
+		header.record_size = sizeof(ResultRecord);
+		os_.write (reinterpret_cast<const char *> (&header), sizeof(header));
+	}
+	else
+	{
+		os_ << "up";
+		for (int p = 0; p < num_players; ++p)
+			os_ << ",score" << p << ",earned" << p << ",passed" << p << ",whammies" << p;
+		os_ << ",decision,solved,depth,play_min,play_max,pass_min,pass_max,nodes,seconds\n";
+	}
+	ok_ = bool(os_);
+	if (!ok_)
+		clog << path_ << ": cannot create\n";
+	thread_ = std::thread (&ResultSink::loop, this);
+}
+
+ResultSink::~ResultSink ()
+{
+	{
+		std::lock_guard<std::mutex> lock (mutex_);
+		stop_ = true;
+	}
+	ready_.notify_one ();
+	thread_.join ();
+}
+
+void ResultSink::push (const ResultRecord& record)
+{
+	if (!ok_)
+		return;
+	bool full;
+	{
+		std::lock_guard<std::mutex> lock (mutex_);
+		pending_.push_back (record);
+		full = pending_.size () >= BatchSize;
+	}
+	if (full)
+		ready_.notify_one ();
+}
+
+size_t ResultSink::written () const
+{
+	std::lock_guard<std::mutex> lock (mutex_);
+	return written_;
+}
+
+/**
+ * Wait for a full batch, a second, or the end, then swap the buffered
+ * records out and write them without holding the lock.
+ */
+void ResultSink::loop ()
+{
+	std::vector<ResultRecord> batch;
+	std::unique_lock<std::mutex> lock (mutex_);
+	for (;;)
+	{
+		ready_.wait_for (lock, std::chrono::seconds (1),
+			[this] { return pending_.size () >= BatchSize || stop_; });
+		bool stop = stop_;
+		batch.swap (pending_);
+		lock.unlock ();
+		if (!batch.empty ())
+		{
+			write (batch);
+			os_.flush ();
+		}
+		lock.lock ();
+		written_ += batch.size ();
+		batch.clear ();
+		if (stop)
+			return;
+	}
+}
+
+void ResultSink::write (const std::vector<ResultRecord>& records)
+{
+	if (format_ == RESULTS_BINARY)
+	{
+		os_.write (reinterpret_cast<const char *> (records.data ()), records.size () * sizeof(ResultRecord));
+	}
+	else
+	{
+		std::string text;
+		char line[256];
+		for (const auto& r : records)
+		{
+			State s;
+			memcpy (&s, r.state, sizeof(s));
+			text.append (line, snprintf (line, sizeof(line), "%u", s.up_num ()));
+			for (const auto& p : s.players)
+				text.append (line, snprintf (line, sizeof(line), ",%u,%u,%u,%u",
+					p.score, p.earned, p.passed, p.whammies));
+			text.append (line, snprintf (line, sizeof(line), ",%s,%u,%u,%.6f,%.6f,%.6f,%.6f,%llu,%.6f\n",
+				decision_name (r.decision), r.solved, r.depth, r.play_win[0], r.play_win[1],
+				r.pass_win[0], r.pass_win[1], (unsigned long long) r.nodes, r.seconds));
+		}
+		os_.write (text.data (), text.size ());
+	}
+	if (!os_)
+	{
+		clog << path_ << ": cannot write results\n";
+		ok_ = false;
+	}
+}
+
+} // namespace pyl
@@ -0,0 +1,102 @@
+#ifndef __PYL_RESULTS_H
+#define __PYL_RESULTS_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "pyl.hpp"
+
+namespace pyl {
+
+/*
+ * Streaming output of search results.
+ *
+ * A ResultRecord holds the outcome of solving one root: the root as given
+ * to Search::run, the decision, the winning intervals of the player up for
+ * each choice (SearchResult), the size of the graph and the time taken.
+ * Search::run pushes one into its ResultSink, if it has one, and a driver
+ * that sweeps over many roots can push its own.
+ *
+ * The sink only appends the record to a buffer; a background thread formats
+ * and writes the buffered records in batches, at least once a second, so a
+ * sweep never waits on its output.  The binary format is a ResultHeader
+ * followed by the records as they are in memory, which read_results (or
+ * numpy.fromfile) loads directly.  The CSV format has a header line and
+ * one row per record, with the state spelled out per player.
+ */
+enum ResultFormat { RESULTS_BINARY, RESULTS_CSV };
+
+struct ResultHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+struct ResultRecord
+{
+	uint32_t state[3];
+	uint8_t decision; /* DecideNode::Decision */
+	uint8_t solved;
+	uint16_t depth;   /* of the last iteration */
+	float play_win[2];  /* min and max */
+	float pass_win[2];
+	uint64_t nodes;
+	double seconds;
+};
+static_assert (sizeof(ResultRecord) == 48, "ResultRecord should be 48 bytes");
+static_assert (sizeof(State) == sizeof(ResultRecord::state), "State does not fit a ResultRecord");
+
+/* CSV for a path ending in .csv, binary otherwise */
+ResultFormat result_format (const std::string& path);
+
+/* Read a binary results file.  Returns false, with a message on clog, if
+the file cannot be read or is not a results file. */
+bool read_results (const std::string& path, std::vector<ResultRecord>& records);
+
+/*
+ * ResultSink - writes result records to a file on a background thread.
+ */
+struct ResultSink
+{
+	ResultSink (const std::string& path, ResultFormat format);
+	/* Writes the records still buffered, then stops the thread */
+	~ResultSink ();
+	ResultSink (const ResultSink&) = delete;
+	ResultSink& operator= (const ResultSink&) = delete;
+
+	/* False if the file could not be created; records are then dropped */
+	bool ok () const { return ok_; }
+
+	void push (const ResultRecord& record);
+
+	/* Number of records written so far */
+	size_t written () const;
+
+private:
+	static constexpr size_t BatchSize = 1024;
+
+	void loop ();
+	void write (const std::vector<ResultRecord>& records);
+
+	const std::string path_;
+	const ResultFormat format_;
+	std::ofstream os_;
+	std::atomic<bool> ok_;
+	mutable std::mutex mutex_;
+	std::condition_variable ready_;
+	std::vector<ResultRecord> pending_;
+	size_t written_ = 0;
+	bool stop_ = false;
+	std::thread thread_;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_RESULTS_H */
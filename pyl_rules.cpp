@@ -0,0 +1,194 @@
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <unordered_map>
+
+#include "pyl_rules.hpp"
+
+namespace pyl {
+
+namespace {
+
+const char *decision_name (DecideNode::Decision decision)
+{
+	return decision == DecideNode::PLAY ? "play" : "pass";
+}
+
+bool before (const MoveRule& a, const MoveRule& b)
+{
+	return a.group() != b.group() ? a.group() < b.group() : a.lead_min < b.lead_min;
+}
+
+} // namespace
+
+uint32_t MoveRule::group (const State& state)
+{
+	unsigned int spins = state.const_up().spins();
+	return uint32_t(spins) << 16 | uint32_t(state.spins() - spins) << 8 | state.const_up().whammies;
+}
+
+void MoveRules::add (const MoveRule& rule)
+{
+	rules_.insert (std::upper_bound (rules_.begin(), rules_.end(), rule, before), rule);
+}
+
+DecideNode::Decision MoveRules::match (const State& state) const
+{
+	MoveRule key{};
+	key.spins = state.const_up().spins();
+	key.opponent_spins = state.spins() - key.spins;
+	key.whammies = state.const_up().whammies;
+	key.lead_min = state.lead();
+	/* The last rule of the group that starts at or below the lead */
+	auto it = std::upper_bound (rules_.begin(), rules_.end(), key, before);
+	if (it == rules_.begin())
+		return DecideNode::UNDECIDED;
+	--it;
+	if (it->group() != key.group() || key.lead_min > it->lead_max)
+		return DecideNode::UNDECIDED;
+	return it->decision;
+}
+
+bool MoveRules::read (const std::string& path)
+{
+	std::ifstream is (path);
+	if (!is)
+	{
+		clog << path << ": cannot open\n";
+		return false;
+	}
+	std::string line;
+	for (unsigned int n = 1; std::getline (is, line); ++n)
+	{
+		if (line.empty() || line[0] == '#')
+			continue;
+		std::istringstream fields (line);
+		std::string decision;
+		unsigned int spins, opponent_spins, whammies;
+		MoveRule rule{};
+		if (!(fields >> decision >> spins >> opponent_spins >> whammies >>
+			rule.lead_min >> rule.lead_max >> rule.support) ||
+			(decision != "play" && decision != "pass") || rule.lead_min > rule.lead_max)
+		{
+			clog << path << ":" << n << ": bad rule\n";
+			return false;
+		}
+		rule.decision = decision == "play" ? DecideNode::PLAY : DecideNode::PASS;
+		rule.spins = spins;
+		rule.opponent_spins = opponent_spins;
+		rule.whammies = whammies;
+		add (rule);
+	}
+	return true;
+}
+
+bool MoveRules::write (const std::string& path) const
+{
+	std::ofstream os (path);
+	os << "# decision spins opponent_spins whammies lead_min lead_max support\n";
+	for (const auto& rule : rules_)
+		os << decision_name (rule.decision) << ' ' << unsigned(rule.spins) << ' ' <<
+			unsigned(rule.opponent_spins) << ' ' << unsigned(rule.whammies) << ' ' <<
+			rule.lead_min << ' ' << rule.lead_max << ' ' << rule.support << '\n';
+	if (!os)
+	{
+		clog << path << ": cannot write rules\n";
+		return false;
+	}
+	return true;
+}
+
+size_t add_samples (const Search& search, std::vector<RuleSample>& samples)
+{
+	size_t count = 0;
+	search.node_cache_->apply ([&] (Node *node) {
+		if (node->kind() != NODE_DECIDE)
+			return;
+		const DecideNode *d = static_cast<const DecideNode *> (node);
+		SearchResult result;
+		if (d->if_play && d->if_pass && d->solved (result, search.options()) &&
+			d->decision() != DecideNode::UNDECIDED)
+		{
+			samples.push_back (RuleSample{ d->state, d->decision() });
+			count++;
+		}
+	});
+	return count;
+}
+
+/**
+ * A state solved more than once keeps its decision only if every solve
+ * agreed.  Each group is then a map from lead to the decision of all of
+ * its states, or UNDECIDED if they differ, with the number of states.
+ */
+MoveRules mine_rules (const std::vector<RuleSample>& samples, unsigned int min_support)
+{
+	std::unordered_map<State, DecideNode::Decision> states;
+	for (const auto& sample : samples)
+	{
+		auto found = states.emplace (sample.state, sample.decision);
+		if (!found.second && found.first->second != sample.decision)
+			found.first->second = DecideNode::UNDECIDED;
+	}
+
+	std::map<uint32_t, std::map<int, std::pair<DecideNode::Decision, uint32_t>>> groups;
+	for (const auto& entry : states)
+	{
+		auto found = groups[MoveRule::group (entry.first)].emplace (entry.first.lead(),
+			std::make_pair (entry.second, 1u));
+		if (!found.second)
+		{
+			auto& lead = found.first->second;
+			if (lead.first != entry.second)
+				lead.first = DecideNode::UNDECIDED;
+			lead.second++;
+		}
+	}
+
+	MoveRules rules;
+	for (const auto& group : groups)
+	{
+		MoveRule rule{};
+		rule.decision = DecideNode::UNDECIDED;
+		rule.spins = group.first >> 16;
+		rule.opponent_spins = group.first >> 8;
+		rule.whammies = group.first;
+		auto flush = [&] {
+			if (rule.decision != DecideNode::UNDECIDED && rule.support >= min_support)
+				rules.add (rule);
+		};
+		for (const auto& lead : group.second)
+		{
+			if (lead.second.first != rule.decision)
+			{
+				flush ();
+				rule.decision = lead.second.first;
+				rule.lead_min = lead.first;
+				rule.support = 0;
+			}
+			rule.lead_max = lead.first;
+			rule.support += lead.second.second;
+		}
+		flush ();
+	}
+	return rules;
+}
+
+void verify_rules (const MoveRules& rules, const std::vector<RuleSample>& samples,
+	size_t& matched, size_t& wrong)
+{
+	matched = wrong = 0;
+	for (const auto& sample : samples)
+	{
+		DecideNode::Decision decision = rules.match (sample.state);
+		if (decision == DecideNode::UNDECIDED)
+			continue;
+		matched++;
+		if (decision != sample.decision)
+			wrong++;
+	}
+}
+
+} // namespace pyl
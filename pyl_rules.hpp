@@ -0,0 +1,91 @@
+#ifndef __PYL_RULES_H
+#define __PYL_RULES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * Move rules - simple play or pass rules mined from solved decide states,
+ * which a search can use to create only the dictated choice of a decide
+ * node below its root (SearchOptions::move_rules), as
+ * always_spin_third_place does.
+ *
+ * A rule tests the spins of the player up, the spins of both opponents
+ * together and the whammies of the player up for equality, and the lead
+ * over the passee for a range.  mine_rules() groups the corpus by the
+ * first three, orders each group by lead, and makes a rule of each run of
+ * leads on which every state has the same decision.  Such a rule has no
+ * disagreement on the corpus by construction, but it only covers the leads
+ * seen in the run, so it says nothing about states between two runs or
+ * beyond the corpus.  Other features of a state, such as the score of the
+ * standby player, are not tested, so the rules are only as safe as the
+ * corpus is representative; check them with verify_rules() on another one.
+ *
+ * The file is text: one rule per line, as the decision, the three counts,
+ * the lead range in dollars and the number of corpus states it covers.
+ * Lines starting with # are comments.
+ */
+struct RuleSample
+{
+	State state;
+	DecideNode::Decision decision;
+};
+
+struct MoveRule
+{
+	DecideNode::Decision decision;
+	uint8_t spins;
+	uint8_t opponent_spins;
+	uint8_t whammies;
+	int lead_min;
+	int lead_max;
+	uint32_t support;
+
+	/* Key of the group of states that the rule tests */
+	static uint32_t group (const State& state);
+	uint32_t group () const { return uint32_t(spins) << 16 | uint32_t(opponent_spins) << 8 | whammies; }
+};
+
+struct MoveRules
+{
+	/* Add a rule; the rules of a group must not overlap */
+	void add (const MoveRule& rule);
+
+	/* The decision of the rule that covers state, or UNDECIDED */
+	DecideNode::Decision match (const State& state) const;
+
+	size_t size () const { return rules_.size(); }
+	const std::vector<MoveRule>& rules () const { return rules_; }
+
+	/* Read or write a rules file.  Return false, with a message on clog,
+	on error. */
+	bool read (const std::string& path);
+	bool write (const std::string& path) const;
+
+private:
+	/* Sorted by group, then lead */
+	std::vector<MoveRule> rules_;
+};
+
+/* Add the decisions of every solved decide node in a search that has both
+choices.  Returns the number added. */
+size_t add_samples (const Search& search, std::vector<RuleSample>& samples);
+
+/* Mine the rules that cover at least min_support states of the corpus.
+A state that appears more than once, with different decisions, breaks
+the runs through its lead. */
+MoveRules mine_rules (const std::vector<RuleSample>& samples, unsigned int min_support);
+
+/* Count the states of a corpus that a rule covers (matched), and those
+among them whose decision differs from the rule's (wrong) */
+void verify_rules (const MoveRules& rules, const std::vector<RuleSample>& samples,
+	size_t& matched, size_t& wrong);
+
+} // namespace pyl
+
+#endif /* __PYL_RULES_H */
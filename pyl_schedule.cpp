@@ -0,0 +1,81 @@
+
+#include <cstdlib>
+
+#include "pyl_schedule.hpp"
+
+namespace pyl {
+
+bool QueryScheduler::may_reach (const State& a, const State& b)
+{
+	for (int p = 0; p < num_players; ++p)
+	{
+		const Player& pa = a.players[p];
+		const Player& pb = b.players[p];
+		if (pb.whammies < pa.whammies)
+			return false;
+		if (pb.score < pa.score && pb.whammies == pa.whammies)
+			return false;
+	}
+	return true;
+}
+
+unsigned int QueryScheduler::distance (const State& a, const State& b)
+{
+	unsigned int d = std::abs (a.total_spins () - b.total_spins ());
+	for (int p = 0; p < num_players; ++p)
+		d += std::abs (int(a.players[p].score) - int(b.players[p].score)) / 1000;
+	return may_reach (a, b) ? d : 2 * d + 1;
+}
+
+size_t QueryScheduler::next (const Search& search)
+{
+	size_t best = 0;
+	if (last_ == SIZE_MAX)
+	{
+		/* Start nearest the end of the game */
+		auto score = [] (const State& s) {
+			unsigned int total = 0;
+			for (int p = 0; p < num_players; ++p)
+				total += s.players[p].score;
+			return total;
+		};
+		for (size_t w = 1; w < waiting_.size(); ++w)
+		{
+			const State& s = roots_[waiting_[w]];
+			const State& b = roots_[waiting_[best]];
+			if (s.total_spins () < b.total_spins () ||
+				(s.total_spins () == b.total_spins () && score (s) > score (b)))
+				best = w;
+		}
+	}
+	else
+	{
+		/* Rank by (not in the cache, distance, index) */
+		const State& last = roots_[last_];
+		bool best_cached = false;
+		unsigned int best_distance = ~0u;
+		for (size_t w = 0; w < waiting_.size(); ++w)
+		{
+			const State& s = roots_[waiting_[w]];
+			/* Search::run solves the root with the other player up */
+			State key{ s };
+			key.change_player ();
+			bool cached = search.node_cache_->find (key, NODE_DECIDE) != nullptr;
+			unsigned int d = distance (last, s);
+			if ((cached && !best_cached) ||
+				(cached == best_cached && (d < best_distance ||
+					(d == best_distance && waiting_[w] < waiting_[best]))))
+			{
+				best = w;
+				best_cached = cached;
+				best_distance = d;
+			}
+		}
+	}
+	last_ = waiting_[best];
+	waiting_[best] = waiting_.back ();
+	waiting_.pop_back ();
+	return last_;
+}
+
+} // namespace pyl
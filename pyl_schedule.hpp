@@ -0,0 +1,58 @@
+#ifndef __PYL_SCHEDULE_H
+#define __PYL_SCHEDULE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * QueryScheduler - orders a batch of roots to be solved by one Search, so
+ * that each search reuses as much as possible of the graph that the
+ * previous ones left in the node cache.
+ *
+ * The batch starts with the root nearest the end of the game (the fewest
+ * spins left, then the highest scores).  Its payoffs are then settled to
+ * max_uncertainty, and stop the scans of later roots whose graphs reach
+ * it.  After that, a root whose decide node is already in the cache is
+ * preferred, as an earlier search reached it and much of its graph
+ * exists.  Among those, or among all roots if there is none, the one
+ * nearest to the root solved last is taken, by distance().
+ *
+ * Each call of next() looks up every waiting root, so ordering N roots
+ * costs O(N^2) cache lookups, which is small next to solving them.
+ */
+struct QueryScheduler
+{
+	void add (State root) { roots_.push_back (root); waiting_.push_back (roots_.size() - 1); }
+
+	bool empty () const { return waiting_.empty(); }
+	size_t size () const { return roots_.size(); }
+	const State& root (size_t n) const { return roots_[n]; }
+
+	/* Remove the root to solve next from the batch and return its index,
+	in the order the roots were added.  search is the one that solved the
+	roots returned so far, if any. */
+	size_t next (const Search& search);
+
+	/* Whether b might follow a in a game: no player has fewer whammies,
+	and a player's score only drops with a whammy */
+	static bool may_reach (const State& a, const State& b);
+
+	/* Distance in a rough unit of one spin: the difference in spins left,
+	plus that in each player's score in $1000, doubled if b cannot follow
+	a */
+	static unsigned int distance (const State& a, const State& b);
+
+private:
+	std::vector<State> roots_;
+	std::vector<size_t> waiting_;
+	size_t last_ = SIZE_MAX;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_SCHEDULE_H */
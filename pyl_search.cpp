@@ -1,8 +1,18 @@
 #include <ostream>
 #include <vector>
+#include <array>
+#include <cstring>
+#include <unordered_set>
 
 #include "pyl.hpp"
 #include "pyl_search.hpp"
+#include "pyl_rules.hpp"
+#include "pyl_perf.hpp"
+#include "pyl_trace.hpp"
+#include "pyl_sweep.hpp"
+#include "pyl_board.hpp"
+#include "pyl_checkpoint.hpp"
+#include "pyl_results.hpp"
 
 namespace pyl {
 
@@ -28,7 +38,7 @@ ostream& operator<< (ostream& os, const Payoff& payoff)
 	os.precision(3);
 	os << '(';
 	if (payoff)
-		for_each(payoff.prob.begin(), payoff.prob.end(),
+		for_each(payoff.prob.begin(), payoff.prob.begin() + num_players,
 			[&os](Prob p) { os << p << ' ';});
 	else
 		os << "nil";
@@ -77,38 +87,113 @@ constexpr bool debug = false;
 constexpr bool opt_passed_spin_merge = true;
 constexpr bool opt_final_spin = true; /* generalize to self-similar subtree */
 
-Search::Search (const SpinOperator& spin, const SearchOptions& options) :
-	spin_op({
-		{ spin }, /* not used */
-	   { spin },
-		{ spin(spin) },
-		{ spin(spin(spin)) },
-		{ spin(spin(spin(spin))) },
-		{ spin(spin(spin(spin(spin)))) },
-		{ spin(spin(spin(spin(spin(spin))))) },
-	}),
+Search::Search (const SearchOptions& options) :
 	options_(options)
 {
 	node_cache_ = new NodeCache();
+	if (options.profile_sample)
+		node_cache_->profiler = std::make_unique<HotStateProfiler> (options.profile_sample);
+}
+
+Search::Search (const SpinOperator& spin, const SearchOptions& options) :
+	Search (options)
+{
+	spin_op[0] = spin; /* not used */
+	spin_op[1] = spin;
+	for (int n = 2; n < MaxPassedSpins; ++n)
+		spin_op[n] = spin (spin_op[n-1]);
+}
+
+/**
+ * Construct from powers that were already computed, such as from a
+ * SpinPowers cache file.
+ */
+Search::Search (const SpinPowers& powers, const SearchOptions& options) :
+	Search (options)
+{
+	std::copy (std::begin(powers.op), std::end(powers.op), spin_op);
 }
 
 Search::~Search ()
 {
+	if (node_cache_->profiler)
+		node_cache_->profiler->print (clog);
 	delete node_cache_;
 }
 
+/* Depth of the iteration after one to depth.  As every node is scanned to
+the full depth of its shortest path, each iteration reaches one more turn
+(a decision and a spin) everywhere in the graph. */
+static int next_depth (int depth)
+{
+	return depth + 2;
+}
+
 DecideNode *Search::run(State init)
 {
+	auto start = std::chrono::steady_clock::now ();
+	const State root{ init };
 	init.change_player ();
 	clog << "\nSearching " << init << '\n';
-	DecideNode *node = node_cache_->create_decide_node (init);
+	trace<TRACE_SEARCH> (TRACE_RUN, init);
+	MemoryStats::reset_peak ();
+#ifdef PYL_PERF
+	PerfCounters::reset ();
+#endif
+	/* The caller keeps the root, which a later run may reach as a child
+	and then freeze, release or compact; pin it so that it outlives this
+	run */
+	DecideNode *node = node_cache_->pin (node_cache_->create_decide_node (init));
+	rescan_.clear ();
+
+	/* Move rules prune below the root only: the root's decision is what
+	the search is asked for, so it must not be the rule's own answer.  The
+	root may also have been expanded under the rules by an earlier run. */
+	if (options_.move_rules)
+	{
+		SearchOptions unruled = options_;
+		unruled.move_rules = nullptr;
+		node->add_choices (*this, unruled);
+	}
+
+	/* Memory growth of the previous iteration, used to extrapolate the
+	size of the next one. */
+	double prev_growth = 0.0;
 
 	bool solved = false;
-	for (int depth = 4; depth < 64 && !solved; depth += (depth < 32) ? 8 : 4)
+	int depth = 4;
+	if (resume_depth_ && init == resume_root_)
+	{
+		depth = next_depth (resume_depth_);
+		clog << "   resuming after depth " << resume_depth_ << '\n';
+	}
+	resume_depth_ = 0;
+	for (; depth < 64 && !solved; depth = next_depth (depth))
 	{
-		node->scan (*this, StopCondition{depth});
+		/* Release what the previous iterations settled before the graph
+		grows again, rather than after the last one */
+		if (options_.freeze)
+		{
+			size_t released = node_cache_->freeze (options_.max_uncertainty);
+			if (released)
+				clog << "   frozen: " << released << " nodes released\n";
+		}
+		size_t start_bytes = MemoryStats::total_bytes;
+		if (options_.breadth_first)
+			scan_levels (node, depth);
+		else
+			node->scan (*this, StopCondition{depth});
+		last_depth_ = depth;
+		if (options_.sweep_payoff)
+		{
+			PayoffSweep sweep;
+			sweep.compile (node);
+			sweep.evaluate ();
+			sweep.store ();
+		}
 		Payoff payoff = node->payoff ();
 		solved = node->solved (result_, options_);
+		trace<TRACE_SEARCH> (TRACE_DEPTH, init, depth, solved, payoff.prob.data());
 
 		clog << "depth " << depth << '\n';
 		if (node->if_play)
@@ -119,8 +204,47 @@ DecideNode *Search::run(State init)
 			clog << "   solved: " << node->decision() << " : " << payoff << '\n';
 		clog << "   cache: total " << node_cache_->size() <<
 			", final " << node_cache_->final_spin_nodes << '\n';
+		/* The page size and kind are cheap to read, unlike the kernel's
+		count of huge pages, which PageHeap::print reads once at exit */
+		clog << "   memory: ";
+		MemoryStats::print (clog);
+		clog << ", pages " << PageHeap::page_size() / 1024 << "K " <<
+			PageHeap::kind_name (PageHeap::kind()) << '\n';
 
 		node_cache_->apply([] (Node *node) { node->invalidate(); });
+		if (options_.compact && !solved && node_cache_->size() * 4 > node_cache_->compacted() * 5)
+		{
+			node_cache_->compact (node, CompactOrder (options_.compact));
+			node = node_cache_->create_decide_node (init);
+		}
+
+		auto now = std::chrono::steady_clock::now ();
+		if (checkpoint_ && !solved && now - last_checkpoint_ >= std::chrono::seconds (checkpoint_interval_))
+		{
+			if (checkpoint_->submit (*this, node, depth))
+				last_checkpoint_ = now;
+		}
+
+		/* Estimate the size after the next iteration by assuming that
+		growth continues at the same rate of change as in this one.  The
+		iteration can end smaller than it began, after compaction, which
+		counts as no growth. */
+		double growth = std::max (0.0, double (MemoryStats::total_bytes) - double (start_bytes));
+		double ratio = (prev_growth > 0.0) ? growth / prev_growth : 1.0;
+		double next = MemoryStats::total_bytes + growth * ratio;
+		prev_growth = growth;
+		if (!solved)
+		{
+			clog << "   next: ~" << size_t(next / 1024) << 'K';
+			if (options_.memory_budget)
+				clog << " of " << options_.memory_budget << "M budget";
+			clog << '\n';
+			if (options_.memory_budget && next > options_.memory_budget * 1048576.0)
+			{
+				clog << "   stopped: next iteration would exceed memory budget\n";
+				break;
+			}
+		}
 #if 0
 		if (depth == 4)
 		{
@@ -130,35 +254,444 @@ DecideNode *Search::run(State init)
 		}
 #endif
 	}
+#ifdef PYL_PERF
+	PerfCounters::print (clog);
+#endif
+	if constexpr (trace_level > 0)
+		TraceBuffer::local ().dump ();
+	record (root, node, solved, start);
 	return node;
 }
 
-TerminalNode *NodeCache::create_terminal_node (const State &ds)
+/**
+ * Push the result of solving init into the result sink, if there is one.
+ */
+void Search::record (State init, const DecideNode *node, bool solved,
+	std::chrono::steady_clock::time_point start) const
 {
-	auto& res = terminal_nodes_[ds];
-	if (!res)
-		res = std::make_unique<TerminalNode> (ds);
-	return res.get();
+	if (!results_)
+		return;
+	ResultRecord r{};
+	memcpy (r.state, &init, sizeof(r.state));
+	r.decision = node->decision ();
+	r.solved = solved;
+	r.depth = last_depth_;
+	r.play_win[0] = result_.play_win.min ();
+	r.play_win[1] = result_.play_win.max ();
+	r.pass_win[0] = result_.pass_win.min ();
+	r.pass_win[1] = result_.pass_win.max ();
+	r.nodes = node_cache_->size ();
+	r.seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	results_->push (r);
 }
 
-SpinNode *NodeCache::create_spin_node (const State &ds)
+/**
+ * Scan the graph below root to depth breadth first, as an alternative to
+ * the depth first walk of Node::scan.  Each level holds the nodes reached with
+ * the same remaining depth.  The children of all the nodes expanded in a
+ * level are collected first and then looked up in the node cache as one
+ * batch, whose probes overlap in memory (NodeCache::create_nodes).
+ *
+ * The rules for each node are those of Node::scan.  As a node is first
+ * reached by a shortest path, it is scanned once, with the most depth
+ * that it could be reached with, where a depth first scan may scan it
+ * again when a shorter path reaches it later.  Both scan the same nodes
+ * to the same depth, but not in the same order.
+ */
+void Search::scan_levels (Node *root, int depth)
+{
+	/* A node expanded in a level, with its first request and the number
+	of requests.  For a decide node, which of its choices were requested. */
+	struct Expansion
+	{
+		Node *node;
+		size_t first;
+		size_t count;
+		bool play;
+		bool pass;
+	};
+	/* Nodes prefetched ahead of the one being checked */
+	constexpr size_t distance = 8;
+
+	std::vector<Node *> level{ root }, next, found;
+	std::vector<Expansion> expansions;
+	std::vector<NodeCache::Request> requests;
+	std::vector<Prob> probs;
+	for (int remaining = depth; !level.empty(); --remaining)
+	{
+		next.clear();
+		expansions.clear();
+		requests.clear();
+		probs.clear();
+		for (size_t n = 0; n < level.size(); ++n)
+		{
+			if (n + distance < level.size())
+				__builtin_prefetch (level[n + distance]);
+			Node *node = level[n];
+			if (node->visited())
+				continue;
+			node->depth(remaining);
+			if (remaining == 0 || node->frozen() || node->payoff_.uncertainty() <= options_.max_uncertainty)
+				continue;
+			trace<TRACE_NODE> (TRACE_SCANNED, node->state, remaining);
+
+			if (node->kind() == NODE_SPIN)
+			{
+				SpinNode *spin = static_cast<SpinNode *> (node);
+				spin->payoff_.invalidate();
+				if (spin->branches.empty())
+				{
+					size_t first = requests.size();
+					for (const auto& s : spin->outcomes (spin_op).terms)
+					{
+						requests.push_back (NodeCache::Request{ s.first, NodeCache::kind_of (s.first) });
+						probs.push_back (s.second);
+					}
+					expansions.push_back (Expansion{ node, first, requests.size() - first, false, false });
+				}
+				else
+				{
+					for (const auto& branch : spin->branches)
+						next.push_back (branch.second);
+				}
+			}
+			else if (node->kind() == NODE_DECIDE)
+			{
+				DecideNode *decide = static_cast<DecideNode *> (node);
+				decide->payoff_.invalidate();
+				if (!decide->if_play && !decide->if_pass)
+				{
+					Expansion e{ node, requests.size(), 0,
+						decide->can_play (options_), decide->can_pass (options_) };
+					if (e.play)
+						requests.push_back (NodeCache::Request{ decide->state, NODE_SPIN });
+					if (e.pass)
+					{
+						State pass = pass_op * decide->state;
+						requests.push_back (NodeCache::Request{ pass, NodeCache::kind_of (pass) });
+					}
+					e.count = requests.size() - e.first;
+					probs.resize (requests.size(), 1.0);
+					expansions.push_back (e);
+				}
+				else
+				{
+					if (decide->if_play)
+						next.push_back (decide->if_play);
+					if (decide->if_pass)
+						next.push_back (decide->if_pass);
+				}
+			}
+		}
+
+		found.resize (requests.size());
+		node_cache_->create_nodes (requests.data(), requests.size(), found.data());
+		for (const Expansion& e : expansions)
+		{
+			if (e.node->kind() == NODE_SPIN)
+			{
+				SpinNode *spin = static_cast<SpinNode *> (e.node);
+				for (size_t r = e.first; r < e.first + e.count; ++r)
+					spin->branches.push_back (SpinNode::Branch{ probs[r], found[r] });
+			}
+			else
+			{
+				DecideNode *decide = static_cast<DecideNode *> (e.node);
+				if (e.play)
+					decide->if_play = found[e.first];
+				if (e.pass)
+					decide->if_pass = found[e.first + e.count - 1];
+			}
+			for (size_t r = e.first; r < e.first + e.count; ++r)
+			{
+				found[r]->link();
+				next.push_back (found[r]);
+			}
+		}
+		level.swap (next);
+	}
+}
+
+void Search::checkpoint (const std::string& path, unsigned int interval)
+{
+	checkpoint_ = std::make_unique<CheckpointWriter> (path);
+	checkpoint_interval_ = interval;
+	last_checkpoint_ = std::chrono::steady_clock::now ();
+}
+
+bool Search::resume (const std::string& path)
+{
+	if (!load_checkpoint (*this, path, resume_root_, resume_depth_))
+		return false;
+	last_depth_ = resume_depth_;
+	clog << path << ": resumed " << node_cache_->size() << " nodes at depth " <<
+		resume_depth_ << '\n';
+	return true;
+}
+
+/**
+ * Switch to a new board, such as after a prize rotation, keeping as much
+ * of the graph as possible.  Spin nodes whose outcomes reach the same
+ * states keep their children and get new probabilities.  The others, as
+ * when the new board has other outcomes than the old one, rebuild their
+ * branches around the children whose states are still reached, and are
+ * scanned again by resolve to expand the new ones.  The payoffs of the
+ * changed spin nodes and of the nodes above them are invalidated, so that
+ * the next run computes them again; the rest are kept.  Returns the
+ * number of spin nodes that changed.
+ */
+size_t Search::update_board (const SpinOperator& spin)
+{
+	if (spin == spin_op[1])
+		return 0;
+	spin_op[0] = spin_op[1] = spin;
+	for (int n = 2; n < MaxPassedSpins; ++n)
+		spin_op[n] = spin (spin_op[n-1]);
+
+	/* Creating nodes would invalidate iteration over the cache, so collect
+	the spin nodes first. */
+	std::vector<SpinNode *> spin_nodes;
+	node_cache_->apply ([&spin_nodes] (Node *node) {
+		if (node->kind() == NODE_SPIN)
+			spin_nodes.push_back (static_cast<SpinNode *> (node));
+	});
+	std::vector<Node *> changed;
+	std::vector<Node *> orphans;
+	for (SpinNode *node : spin_nodes)
+	{
+		BranchUpdate update = node->update_branches (*this, orphans);
+		if (update == BRANCHES_SAME)
+			continue;
+		changed.push_back (node);
+		if (update == BRANCHES_REBUILT)
+			rescan_.push_back (node->state);
+	}
+	size_t count = changed.size();
+	size_t released = node_cache_->release_orphans (orphans);
+
+	/* The payoffs of frozen nodes were computed with the old board, and
+	below a frozen spin node the graph is gone, so thaw them to be expanded
+	again.  A frozen decide node still has its choices, and its payoff
+	changes only if theirs do. */
+	node_cache_->apply ([this, &changed] (Node *node) {
+		if (node->frozen())
+		{
+			node->frozen(false);
+			if (node->kind() == NODE_SPIN)
+			{
+				rescan_.push_back (node->state);
+				changed.push_back (node);
+			}
+		}
+	});
+
+	/* Only the payoffs of the changed spin nodes and of the nodes above
+	them are computed again. */
+	size_t invalidated = node_cache_->invalidate_above (changed);
+
+	clog << "   board update: " << count << " spin nodes changed, " <<
+		invalidated << " of " << node_cache_->size() << " payoffs invalidated";
+	if (released)
+		clog << ", " << released << " nodes released";
+	clog << '\n';
+	return count;
+}
+
+/**
+ * Solve init again after update_board, reusing the graph of the previous
+ * run.  If no spin node was rebuilt or thawed, the graph is complete and
+ * only the invalidated payoffs are computed again.  Otherwise only the
+ * graph below those nodes is scanned, each with the depth that the
+ * previous run left it: that run's depth less the node's shortest
+ * distance from the root, found breadth first.  If that no longer solves
+ * init, fall back to a full run.
+ */
+DecideNode *Search::resolve (State init)
+{
+	if (last_depth_ == 0)
+		return run (init);
+
+	auto begin = std::chrono::steady_clock::now ();
+	State start{ init };
+	start.change_player ();
+	DecideNode *node = static_cast<DecideNode *> (node_cache_->find (start, NODE_DECIDE));
+	if (!node)
+		return run (init);
+	clog << "\nResolving " << start << " at depth " << last_depth_ << '\n';
+
+	std::unordered_set<const Node *> wanted;
+	for (const State& s : rescan_)
+		if (const Node *n = node_cache_->find (s, NODE_SPIN))
+			wanted.insert (n);
+	rescan_.clear ();
+
+	if (!wanted.empty())
+	{
+		std::vector<std::pair<Node *, int>> targets;
+		std::unordered_set<const Node *> seen{ node };
+		std::vector<Node *> level{ node }, next;
+		auto reach = [&] (Node *child) {
+			if (child && seen.insert (child).second)
+				next.push_back (child);
+		};
+		for (int depth = last_depth_; depth > 0 && !level.empty() && targets.size() < wanted.size(); --depth)
+		{
+			next.clear ();
+			for (Node *n : level)
+			{
+				if (wanted.count (n))
+					targets.emplace_back (n, depth);
+				if (n->kind() == NODE_SPIN)
+				{
+					for (const auto& branch : static_cast<SpinNode *> (n)->branches)
+						reach (branch.second);
+				}
+				else if (n->kind() == NODE_DECIDE)
+				{
+					reach (static_cast<DecideNode *> (n)->if_play);
+					reach (static_cast<DecideNode *> (n)->if_pass);
+				}
+			}
+			level.swap (next);
+		}
+
+		clog << "   rescanning below " << targets.size() << " spin nodes\n";
+		for (const auto& target : targets)
+			target.first->scan (*this, StopCondition{target.second});
+		node_cache_->apply([] (Node *node) { node->invalidate(); });
+	}
+
+	Payoff payoff = node->payoff ();
+	if (node->solved (result_, options_))
+	{
+		clog << "   solved: " << node->decision() << " : " << payoff << '\n';
+		record (init, node, true, begin);
+		return node;
+	}
+	return run (init);
+}
+
+size_t NodeCache::hash (const State& ds, NodeKind kind)
+{
+	uint32_t w[3];
+	memcpy (w, &ds, sizeof(w));
+	uint64_t h = (uint64_t(w[1]) << 32 | w[0]) * 0x9e3779b97f4a7c15ULL;
+	h ^= (uint64_t(w[2]) << 2 | kind) * 0xc2b2ae3d27d4eb4fULL;
+	return h ^ (h >> 29);
+}
+
+/* The table is kept at most 3/4 full */
+void NodeCache::reserve (size_t count)
+{
+	if ((used_ + count) * 4 <= slots_.size() * 3)
+		return;
+	size_t capacity = slots_.empty() ? 64 : slots_.size();
+	while ((used_ + count) * 4 > capacity * 3)
+		capacity *= 2;
+	decltype(slots_) old (capacity, Slot{ State{}, 0 });
+	old.swap (slots_);
+	for (const Slot& slot : old)
+		if (slot.ref)
+			place (slot);
+}
+
+void NodeCache::place (const Slot& slot)
 {
-	auto& res = spin_nodes_[ds];
-	if (!res)
+	size_t mask = slots_.size() - 1;
+	size_t i = hash (slot.state, NodeKind (slot.ref >> KindShift)) & mask;
+	while (slots_[i].ref)
+		i = (i + 1) & mask;
+	slots_[i] = slot;
+}
+
+Node *NodeCache::node_at (uint32_t ref) const
+{
+	uint32_t n = (ref & ((1u << KindShift) - 1)) - 1;
+	switch (ref >> KindShift)
 	{
-		res = std::make_unique<SpinNode> (ds);
+		case NODE_SPIN: return spin_nodes_[n];
+		case NODE_DECIDE: return decide_nodes_[n];
+		default: return terminal_nodes_[n];
+	}
+}
+
+/**
+ * Probe the table from the slot of hash h, and create the node if the
+ * state is not there.  The table must have room for one more node.
+ */
+Node *NodeCache::find_or_create (const State& ds, NodeKind kind, size_t h)
+{
+	PERF_SCOPE(PERF_CREATE_NODE);
+	size_t mask = slots_.size() - 1;
+	size_t i = h & mask;
+	for (; slots_[i].ref; i = (i + 1) & mask)
+		if ((slots_[i].ref >> KindShift) == kind && slots_[i].state == ds)
+			return node_at (slots_[i].ref);
+
+	Node *node;
+	size_t n;
+	if (kind == NODE_SPIN)
+	{
+		spin_nodes_.push_back (new SpinNode (ds));
+		node = spin_nodes_.back();
+		n = spin_nodes_.size();
 		if (ds.spins() == 1)
 			final_spin_nodes++;
 	}
-	return res.get();
+	else if (kind == NODE_DECIDE)
+	{
+		decide_nodes_.push_back (new DecideNode (ds));
+		node = decide_nodes_.back();
+		n = decide_nodes_.size();
+	}
+	else
+	{
+		terminal_nodes_.push_back (new TerminalNode (ds));
+		node = terminal_nodes_.back();
+		n = terminal_nodes_.size();
+	}
+	trace<TRACE_NODE> (TRACE_CREATED, ds, 0, TraceNodeKind (kind));
+	slots_[i] = Slot{ ds, uint32_t(kind) << KindShift | uint32_t(n) };
+	used_++;
+	return node;
+}
+
+size_t NodeCache::slot_of (const Node *node) const
+{
+	size_t mask = slots_.size() - 1;
+	size_t i = hash (node->state, node->kind()) & mask;
+	while ((slots_[i].ref >> KindShift) != node->kind() || !(slots_[i].state == node->state))
+		i = (i + 1) & mask;
+	return i;
+}
+
+Node *NodeCache::find (const State& ds, NodeKind kind) const
+{
+	if (slots_.empty())
+		return nullptr;
+	size_t mask = slots_.size() - 1;
+	for (size_t i = hash (ds, kind) & mask; slots_[i].ref; i = (i + 1) & mask)
+		if ((slots_[i].ref >> KindShift) == kind && slots_[i].state == ds)
+			return node_at (slots_[i].ref);
+	return nullptr;
+}
+
+TerminalNode *NodeCache::create_terminal_node (const State &ds)
+{
+	reserve (1);
+	return static_cast<TerminalNode *> (find_or_create (ds, NODE_TERMINAL, hash (ds, NODE_TERMINAL)));
+}
+
+SpinNode *NodeCache::create_spin_node (const State &ds)
+{
+	reserve (1);
+	return static_cast<SpinNode *> (find_or_create (ds, NODE_SPIN, hash (ds, NODE_SPIN)));
 }
 
 DecideNode *NodeCache::create_decide_node (const State &ds)
 {
-	auto& res = decide_nodes_[ds];
-	if (!res)
-		res = std::make_unique<DecideNode> (ds);
-	return res.get();
+	reserve (1);
+	return static_cast<DecideNode *> (find_or_create (ds, NODE_DECIDE, hash (ds, NODE_DECIDE)));
 }
 
 /**
@@ -167,24 +700,573 @@ DecideNode *NodeCache::create_decide_node (const State &ds)
  */
 Node *NodeCache::create_node (const State &ds)
 {
-	if (ds.terminal())
-		return create_terminal_node (ds);
-	else if (ds.can_pass())
-		return create_decide_node (ds);
+	if (profiler)
+		profiler->lookup (ds);
+	NodeKind kind = kind_of (ds);
+	reserve (1);
+	return find_or_create (ds, kind, hash (ds, kind));
+}
+
+/**
+ * Resolve a batch of states a group at a time.  All the states of a group
+ * are hashed and their slots prefetched before any is probed, so that the
+ * cache misses of the independent probes overlap instead of following one
+ * another.  Room for the group is made first, as growing the table would
+ * move the prefetched slots.
+ */
+void NodeCache::create_nodes (const Request *requests, size_t count, Node **out)
+{
+	/* Enough probes in flight to cover the memory latency, while their
+	slots still fit in the L1 cache */
+	constexpr size_t group = 32;
+	size_t hashes[group];
+
+	for (size_t begin = 0; begin < count; begin += group)
+	{
+		size_t end = std::min (count, begin + group);
+		reserve (end - begin);
+		size_t mask = slots_.size() - 1;
+		for (size_t n = begin; n < end; ++n)
+		{
+			hashes[n - begin] = hash (requests[n].state, requests[n].kind);
+			__builtin_prefetch (&slots_[hashes[n - begin] & mask]);
+		}
+		for (size_t n = begin; n < end; ++n)
+		{
+			if (profiler)
+				profiler->lookup (requests[n].state);
+			out[n] = find_or_create (requests[n].state, requests[n].kind, hashes[n - begin]);
+		}
+	}
+}
+
+NodeCache::~NodeCache ()
+{
+	apply ([this] (Node *node) { release (node); });
+	if (arena_)
+	{
+		MemoryStats::remove (MEM_NODES, arena_bytes_);
+		PageHeap::deallocate (arena_, arena_bytes_);
+	}
+}
+
+void NodeCache::release (Node *node)
+{
+	if (in_arena (node))
+		node->~Node ();
 	else
-		return create_spin_node (ds);
+		delete node;
+}
+
+namespace {
+
+/* Set res to the n-th child of a node, which is null for a choice that a
+decide node does not have.  Returns false past the last child. */
+bool child (const Node *node, NodeKind kind, size_t n, Node *& res)
+{
+	if (kind == NODE_SPIN)
+	{
+		const SpinNode *spin = static_cast<const SpinNode *> (node);
+		if (n >= spin->branches.size())
+			return false;
+		res = spin->branches[n].second;
+		return true;
+	}
+	if (kind == NODE_DECIDE && n < 2)
+	{
+		const DecideNode *decide = static_cast<const DecideNode *> (node);
+		res = n == 0 ? decide->if_play : decide->if_pass;
+		return true;
+	}
+	return false;
 }
 
+constexpr size_t node_size[] = { sizeof(TerminalNode), sizeof(DecideNode), sizeof(SpinNode) };
+
+} // namespace
+
 /**
- * Return the payoff for a node.
+ * Order the nodes with an explicit stack, as the graph can be deeper than
+ * the call stack allows, marking each node visited as it is reached.  Then
+ * copy each node into the new block.  Copying also gives the branches of
+ * each spin node a new array, and as these are all allocated before the
+ * old ones are freed, they too end up mostly in walk order.  The new
+ * address is left in the old node's payoff, which has been copied, as a
+ * forwarding pointer.  The links are then
+ * translated by reading each target's forwarding pointer, before the old
+ * nodes are released.  This costs about as much as a walk over the graph;
+ * a map from old to new addresses would cost several times more.
+ *
+ * A pinned node is not copied, and links to it are kept as they are.  It
+ * is never in the old block, as pin() moves it out of there.
+ */
+void NodeCache::compact (const Node *root, CompactOrder order)
+{
+	struct Frame
+	{
+		Node *node;
+		NodeKind kind;
+		size_t next; /* next child to visit */
+	};
+	static_assert (sizeof(Payoff) >= sizeof(Node *), "Payoff cannot hold a forwarding pointer");
+	auto forward = [] (Node *from, Node *to) { memcpy (static_cast<void *> (&from->payoff_), &to, sizeof(to)); };
+	auto forwarded = [] (Node *from) {
+		Node *to = from;
+		if (from && !from->pinned())
+			memcpy (&to, &from->payoff_, sizeof(to));
+		return to;
+	};
+
+	apply ([] (Node *node) { node->invalidate(); });
+	std::vector<std::pair<Node *, NodeKind>> nodes;
+	nodes.reserve (spin_nodes_.size() + decide_nodes_.size() + terminal_nodes_.size());
+	std::vector<Frame> stack;
+	auto enter = [&] (Node *node) {
+		if (!node || node->visited())
+			return;
+		node->visited(true);
+		NodeKind kind = node->kind ();
+		if (order == COMPACT_PREORDER)
+			nodes.emplace_back (node, kind);
+		stack.push_back (Frame{ node, kind, 0 });
+	};
+	enter (const_cast<Node *> (root));
+	while (!stack.empty())
+	{
+		Frame& top = stack.back();
+		Node *next;
+		if (child (top.node, top.kind, top.next, next))
+		{
+			top.next++;
+			enter (next);
+		}
+		else
+		{
+			if (order == COMPACT_POSTORDER)
+				nodes.emplace_back (top.node, top.kind);
+			stack.pop_back();
+		}
+	}
+	apply ([&] (Node *node) {
+		if (!node->visited())
+			nodes.emplace_back (node, node->kind ());
+	});
+
+	size_t bytes = 0;
+	for (const auto& n : nodes)
+		if (!n.first->pinned())
+			bytes += node_size[n.second];
+	static_assert (sizeof(TerminalNode) % alignof(SpinNode) == 0 &&
+		sizeof(DecideNode) % alignof(SpinNode) == 0 &&
+		sizeof(SpinNode) % alignof(SpinNode) == 0, "Nodes do not pack");
+	char *arena = static_cast<char *> (PageHeap::allocate (bytes));
+	MemoryStats::add (MEM_NODES, bytes);
+
+	size_t offset = 0;
+	for (auto& n : nodes)
+	{
+		if (n.first->pinned())
+		{
+			n.first->invalidate();
+			continue;
+		}
+		void *p = arena + offset;
+		offset += node_size[n.second];
+		Node *node;
+		if (n.second == NODE_SPIN)
+			node = ::new (p) SpinNode (*static_cast<SpinNode *> (n.first));
+		else if (n.second == NODE_DECIDE)
+			node = ::new (p) DecideNode (*static_cast<DecideNode *> (n.first));
+		else
+			node = ::new (p) TerminalNode (*static_cast<TerminalNode *> (n.first));
+		node->invalidate();
+		forward (n.first, node);
+	}
+
+	for (const auto& n : nodes)
+	{
+		Node *node = forwarded (n.first);
+		if (n.second == NODE_SPIN)
+		{
+			for (auto& branch : static_cast<SpinNode *> (node)->branches)
+				branch.second = forwarded (branch.second);
+		}
+		else if (n.second == NODE_DECIDE)
+		{
+			DecideNode *decide = static_cast<DecideNode *> (node);
+			decide->if_play = forwarded (decide->if_play);
+			decide->if_pass = forwarded (decide->if_pass);
+		}
+	}
+	for (auto& n : nodes)
+	{
+		Node *node = forwarded (n.first);
+		if (node != n.first)
+			release (n.first);
+		n.first = node;
+	}
+	if (arena_)
+	{
+		MemoryStats::remove (MEM_NODES, arena_bytes_);
+		PageHeap::deallocate (arena_, arena_bytes_);
+	}
+	arena_ = arena;
+	arena_bytes_ = bytes;
+
+	spin_nodes_.clear();
+	decide_nodes_.clear();
+	terminal_nodes_.clear();
+	std::fill (slots_.begin(), slots_.end(), Slot{ State{}, 0 });
+	for (const auto& n : nodes)
+	{
+		size_t position;
+		if (n.second == NODE_SPIN)
+		{
+			spin_nodes_.push_back (static_cast<SpinNode *> (n.first));
+			position = spin_nodes_.size();
+		}
+		else if (n.second == NODE_DECIDE)
+		{
+			decide_nodes_.push_back (static_cast<DecideNode *> (n.first));
+			position = decide_nodes_.size();
+		}
+		else
+		{
+			terminal_nodes_.push_back (static_cast<TerminalNode *> (n.first));
+			position = terminal_nodes_.size();
+		}
+		place (Slot{ n.first->state, uint32_t(n.second) << KindShift | uint32_t(position) });
+	}
+	compacted_ = size();
+}
+
+/**
+ * A node in the block is copied to the heap, and every link to it, from
+ * its parents and from the node list that its slot refers to, is pointed
+ * at the copy.  This takes a
+ * pass over the edges, but only for a root that the last compact() moved,
+ * once per run.
+ */
+DecideNode *NodeCache::pin (DecideNode *node)
+{
+	if (in_arena (node))
+	{
+		DecideNode *copy = new DecideNode (*node);
+		for (SpinNode *spin : spin_nodes_)
+			for (auto& branch : spin->branches)
+				if (branch.second == node)
+					branch.second = copy;
+		for (DecideNode *decide : decide_nodes_)
+			if (decide->if_pass == node)
+				decide->if_pass = copy;
+		decide_nodes_[(slots_[slot_of (node)].ref & ((1u << KindShift) - 1)) - 1] = copy;
+		release (node);
+		node = copy;
+	}
+	node->pin();
+	return node;
+}
+
+/**
+ * The scan stops at a node once the uncertainty of its payoff is no more
+ * than max_uncertainty, and never expands it again, so its payoff does
+ * not change any more and nothing below it is needed.  Freeze every such
+ * node: a spin node unlinks its branches and frees their array, while a
+ * decide node keeps its two choices, so that its decision can still be
+ * read.  A node whose last link is removed is destroyed and unlinks its
+ * own children in turn; the count of links kept in every node makes this
+ * a single pass over the frozen nodes rather than a walk of the graph.
+ * The root of every run is pinned with a link of its own, so it is kept.
+ *
+ * Destroyed nodes are removed from the node lists, and the table is then
+ * filled again from the lists, as in compact().
+ */
+size_t NodeCache::freeze (Prob limit)
+{
+	std::vector<Node *> dead;
+	for (SpinNode *node : spin_nodes_)
+	{
+		if (node->frozen() || node->branches.empty() || node->payoff_.uncertainty() > limit)
+			continue;
+		node->frozen(true);
+		for (const auto& branch : node->branches)
+			if (branch.second->unlink())
+				dead.push_back (branch.second);
+		decltype(node->branches) ().swap (node->branches);
+	}
+	for (DecideNode *node : decide_nodes_)
+		if (!node->frozen() && node->payoff_.uncertainty() <= limit)
+			node->frozen(true);
+	return release_unlinked (dead);
+}
+
+/**
+ * Nodes that lost their last link while the cache was being changed, such
+ * as the old children of a spin node whose branches were rebuilt, are
+ * released as in freeze().  A node in orphans that has been linked again
+ * since is kept.
+ */
+size_t NodeCache::release_orphans (std::vector<Node *>& orphans)
+{
+	std::sort (orphans.begin(), orphans.end());
+	orphans.erase (std::unique (orphans.begin(), orphans.end()), orphans.end());
+	orphans.erase (std::remove_if (orphans.begin(), orphans.end(),
+		[] (const Node *node) { return node->linked(); }), orphans.end());
+	return release_unlinked (orphans);
+}
+
+/**
+ * Destroy the nodes in dead, which no node links to, and every node below
+ * them that loses its last link in turn.
+ */
+size_t NodeCache::release_unlinked (std::vector<Node *>& dead)
+{
+	if (dead.empty())
+		return 0;
+	auto drop = [&] (Node *child) {
+		if (child && child->unlink())
+			dead.push_back (child);
+	};
+
+	for (size_t n = 0; n < dead.size(); ++n)
+	{
+		Node *node = dead[n];
+		if (node->kind() == NODE_SPIN)
+		{
+			for (const auto& branch : static_cast<SpinNode *> (node)->branches)
+				drop (branch.second);
+		}
+		else if (node->kind() == NODE_DECIDE)
+		{
+			drop (static_cast<DecideNode *> (node)->if_play);
+			drop (static_cast<DecideNode *> (node)->if_pass);
+		}
+	}
+
+	std::sort (dead.begin(), dead.end());
+	auto is_dead = [&dead] (const Node *node) { return std::binary_search (dead.begin(), dead.end(), node); };
+	for (const SpinNode *node : spin_nodes_)
+		if (node->state.spins() == 1 && is_dead (node))
+			final_spin_nodes--;
+	spin_nodes_.erase (std::remove_if (spin_nodes_.begin(), spin_nodes_.end(), is_dead), spin_nodes_.end());
+	decide_nodes_.erase (std::remove_if (decide_nodes_.begin(), decide_nodes_.end(), is_dead), decide_nodes_.end());
+	terminal_nodes_.erase (std::remove_if (terminal_nodes_.begin(), terminal_nodes_.end(), is_dead), terminal_nodes_.end());
+
+	std::fill (slots_.begin(), slots_.end(), Slot{ State{}, 0 });
+	used_ = 0;
+	for (size_t n = 0; n < spin_nodes_.size(); ++n, ++used_)
+		place (Slot{ spin_nodes_[n]->state, uint32_t(NODE_SPIN) << KindShift | uint32_t(n + 1) });
+	for (size_t n = 0; n < decide_nodes_.size(); ++n, ++used_)
+		place (Slot{ decide_nodes_[n]->state, uint32_t(NODE_DECIDE) << KindShift | uint32_t(n + 1) });
+	for (size_t n = 0; n < terminal_nodes_.size(); ++n, ++used_)
+		place (Slot{ terminal_nodes_[n]->state, uint32_t(NODE_TERMINAL) << KindShift | uint32_t(n + 1) });
+
+	for (Node *node : dead)
+		release (node);
+	return dead.size();
+}
+
+/**
+ * Invalidate the changed nodes, then walk up from them, using a missing
+ * payoff to mark a node as visited.  A node with a missing child payoff
+ * is invalidated at once; otherwise the parents of its children are
+ * listed, numbering the nodes by their slot in the table, so that only
+ * edges between nodes still holding a payoff are looked up.  A node's
+ * link count bounds the number of its parents, so the lists are laid out
+ * from the counts before a single pass over the edges fills them.  A
+ * terminal node never changes, so edges to one are skipped.
+ *
+ * If a count has stuck at its maximum, the lists cannot be laid out from
+ * it, and every payoff but those of terminal nodes is invalidated.
+ */
+size_t NodeCache::invalidate_above (const std::vector<Node *>& changed)
+{
+	size_t invalidated = 0;
+	for (Node *node : changed)
+		if (node->payoff_)
+		{
+			node->payoff_.invalidate ();
+			invalidated++;
+		}
+
+	size_t count = slots_.size();
+	std::vector<uint32_t> begin (count + 1, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		unsigned int links = 0;
+		if (slots_[i].ref && (slots_[i].ref >> KindShift) != NODE_TERMINAL)
+		{
+			const Node *node = node_at (slots_[i].ref);
+			if (node->payoff_)
+				links = node->links();
+			if (links == Node::MaxParents)
+			{
+				apply ([&invalidated] (Node *node) {
+					if (node->kind() != NODE_TERMINAL && node->payoff_)
+					{
+						node->payoff_.invalidate ();
+						invalidated++;
+					}
+				});
+				return invalidated;
+			}
+		}
+		begin[i + 1] = begin[i] + links;
+	}
+
+	std::vector<uint32_t> end (begin.begin(), begin.end() - 1);
+	std::vector<uint32_t> parents (begin[count]);
+	std::vector<uint32_t> stack;
+	auto add = [&] (uint32_t parent, const Node *child) {
+		if (!child || child->kind() == NODE_TERMINAL)
+			return true;
+		if (!child->payoff_)
+		{
+			stack.push_back (parent);
+			return false;
+		}
+		parents[end[slot_of (child)]++] = parent;
+		return true;
+	};
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!slots_[i].ref)
+			continue;
+		const Node *node = node_at (slots_[i].ref);
+		if (!node->payoff_)
+			continue;
+		if (node->kind() == NODE_SPIN)
+		{
+			for (const auto& branch : static_cast<const SpinNode *> (node)->branches)
+				if (!add (i, branch.second))
+					break;
+		}
+		else if (node->kind() == NODE_DECIDE)
+		{
+			if (add (i, static_cast<const DecideNode *> (node)->if_play))
+				add (i, static_cast<const DecideNode *> (node)->if_pass);
+		}
+	}
+
+	while (!stack.empty())
+	{
+		uint32_t i = stack.back();
+		stack.pop_back();
+		Node *node = node_at (slots_[i].ref);
+		if (!node->payoff_)
+			continue;
+		node->payoff_.invalidate ();
+		invalidated++;
+		for (uint32_t p = begin[i]; p < end[i]; ++p)
+			stack.push_back (parents[p]);
+	}
+	return invalidated;
+}
+
+/**
+ * Return the payoff for a node, computing it first if needed.
  */
 const Payoff& Node::payoff() const
 {
 	if (!payoff_)
-		calc_payoff ();
+		calc_payoffs ();
 	return payoff_;
 }
 
+/**
+ * Compute the payoff of this node and of every node below it whose payoff
+ * is not known, children before parents.  The children of a node are
+ * visited in order, each one pushed onto the stack if its payoff is not
+ * known, and the node's payoff is computed once all of theirs are.
+ *
+ * The payoff for a SpinNode is the weighted sum of the payoffs of each of
+ * the spin outcomes, which is accumulated in its frame as they become
+ * known.  A spin node clears its payoff when it is pushed, which marks it
+ * as computed.  Score saturation at MaxScore can make the graph cyclic,
+ * and this is what stops the traversal when a cycle leads back to it.
+ *
+ * A decide node does not, so a cycle back to a decide node whose payoff
+ * is being computed computes it again above itself (see PayoffSweep).
+ */
+void Node::calc_payoffs () const
+{
+	PERF_SCOPE(PERF_CALC_PAYOFF);
+	struct Frame
+	{
+		const Node *node;
+		size_t next; /* next child to visit */
+		Payoff sum;  /* of a spin node, over the children visited */
+	};
+	std::vector<Frame> stack;
+
+	auto push = [&stack] (const Node *node) {
+		if (node->kind() == NODE_SPIN)
+			node->payoff_.clear ();
+		stack.push_back (Frame{node, 0, Payoff()});
+		stack.back().sum.clear ();
+	};
+
+	push (this);
+	while (!stack.empty ())
+	{
+		Frame& frame = stack.back ();
+		const Node *node = frame.node;
+		const Node *next = nullptr;
+		if (node->kind() == NODE_SPIN)
+		{
+			/* Work on locals, which the compiler can keep in registers */
+			const auto& branches = static_cast<const SpinNode *> (node)->branches;
+			const SpinNode::Branch *branch = branches.data() + frame.next;
+			const SpinNode::Branch *end = branches.data() + branches.size();
+#ifdef __SSE__
+			__m128 sum = frame.sum.load ();
+			for (; branch != end; ++branch)
+			{
+				if (!branch->second->payoff_)
+					break;
+				sum = Payoff::fma (sum, branch->second->payoff_.load(), branch->first);
+			}
+			frame.sum.store (sum);
+#else
+			for (; branch != end; ++branch)
+			{
+				if (!branch->second->payoff_)
+					break;
+				Payoff p = branch->second->payoff_;
+				p *= branch->first;
+				frame.sum += p;
+			}
+#endif
+			frame.next = branch - branches.data();
+			if (branch != end)
+				next = branch->second;
+			else
+				node->payoff_ = frame.sum;
+		}
+		else if (node->kind() == NODE_DECIDE)
+		{
+			const DecideNode *decide = static_cast<const DecideNode *> (node);
+			for (; frame.next < 2 && !next; ++frame.next)
+			{
+				const Node *c = frame.next == 0 ? decide->if_play : decide->if_pass;
+				if (c && !c->payoff_)
+					next = c;
+			}
+			if (!next)
+				decide->calc_payoff ();
+		}
+		else
+			static_cast<const TerminalNode *> (node)->calc_payoff ();
+
+		/* Once the child is popped, the node resumes at that child, which
+		now has a payoff */
+		if (next)
+			push (next);
+		else
+			stack.pop_back ();
+	}
+}
+
 
 /**
  * Perform a single scan of a tree node.  Construct the entire search tree
@@ -193,26 +1275,73 @@ const Payoff& Node::payoff() const
  *
  * Invoking scan on the same node again with the same stop condition is
  * a no-op.  Cached payoffs will not be invalidated in this case.
+ *
+ * Each node records the most remaining depth it has been scanned with.
+ * A node that is reached again, by another path, is scanned again only if
+ * that path leaves it more depth, so that every node is scanned to the
+ * full depth of its shortest path from the root, as if the graph were a
+ * tree, but no node is scanned twice with the same depth.
+ *
+ * The graph is walked depth first with a stack of the nodes still to be
+ * scanned.  A node pushes its children in reverse, so that they are
+ * scanned in order, each with its whole subtree before the next; as a
+ * node is only checked when it is popped, the nodes are scanned in the
+ * same order and with the same depth as by a recursion.
  */
 void Node::scan (const Search& search, const StopCondition& stop)
 {
-	if (visited())
-		return;
-	visited(true);
+	struct Frame
+	{
+		Node *node;
+		StopCondition stop;
+	};
+	static thread_local std::vector<Frame> stack;
+	const size_t base = stack.size ();
 
-	if (stop.depth == 0)
-		return;
+	stack.push_back (Frame{this, stop});
+	while (stack.size () > base)
+	{
+		Frame frame = stack.back ();
+		stack.pop_back ();
+		Node *node = frame.node;
+		if (node->depth() >= frame.stop.depth)
+			continue;
+		node->depth(frame.stop.depth);
 
-	/* If the payoff for this node was calculated in a previous search
-	(at a lower total depth) and the uncertainty is low enough, then don't
-	scan it any further.  This is the same check that is done in the top
-	level search to terminate the entire search at the root node. */
-	if (payoff_.uncertainty() <= search.options().max_uncertainty)
-		return;
+		if (frame.stop.depth == 0 || node->frozen())
+			continue;
 
-	if (debug)
-		clog << "Scanning " << this << " at " << stop << '\n';
-	scan_branches(search, stop.deeper());
+		/* If the payoff for this node was calculated in a previous search
+		(at a lower total depth) and the uncertainty is low enough, then don't
+		scan it any further.  This is the same check that is done in the top
+		level search to terminate the entire search at the root node. */
+		if (node->payoff_.uncertainty() <= search.options().max_uncertainty)
+			continue;
+
+		if (debug)
+			clog << "Scanning " << node << " at " << frame.stop << '\n';
+		trace<TRACE_NODE> (TRACE_SCANNED, node->state, frame.stop.depth);
+		node->expand (search);
+
+		/* A child scanned already with as much depth would be skipped
+		when popped */
+		StopCondition deeper = frame.stop.deeper ();
+		auto push = [&] (Node *c) {
+			if (c && c->depth() < deeper.depth)
+				stack.push_back (Frame{c, deeper});
+		};
+		if (node->kind() == NODE_SPIN)
+		{
+			const auto& branches = static_cast<SpinNode *> (node)->branches;
+			for (size_t n = branches.size(); n-- > 0; )
+				push (branches[n].second);
+		}
+		else if (node->kind() == NODE_DECIDE)
+		{
+			push (static_cast<DecideNode *> (node)->if_pass);
+			push (static_cast<DecideNode *> (node)->if_play);
+		}
+	}
 }
 
 /*********************************************************************/
@@ -224,22 +1353,18 @@ percentage of each element. */
 both parameters are all zero. */
 Payoff merge(const Payoff& first, const Payoff& second)
 {
-	Payoff result;
-
-	for (size_t n = 0; n < num_players; ++n)
-		result.prob[n] = std::min(first[n], second[n]);
-
-	return result;
+	return Payoff::min (first, second);
 }
 
 /*********************************************************************/
 
-void TerminalNode::scan_branches (const Search& search, const StopCondition& stop)
+void TerminalNode::expand (const Search& search)
 {
 }
 
 void TerminalNode::calc_payoff () const
 {
+	PERF_SCOPE(PERF_CALC_PAYOFF);
 	/* Payoff per player in a final state is 0.0 if you lose, 1.0 if
 	you win, and somewhere in between for an unlikely tie.  The sum
 	of all components of the payoff vector is always 1.0 for a final
@@ -277,81 +1402,212 @@ void TerminalNode::calc_payoff () const
 }
 
 /**
- * Scanning a spinning node means to evaluate all possible outcomes of
- * spinning the board.
+ * Return the number of spins taken at once from this node.  Passed spins
+ * are merged, up to 5, as there is no choice between them.
+ */
+unsigned int SpinNode::spin_count () const
+{
+	if (opt_passed_spin_merge && state.const_up().passed > 0)
+		return min(static_cast<int> (state.const_up().passed), 5);
+	else
+		return 1;
+}
+
+/**
+ * Return the states reached by spinning from this node with the given
+ * board powers, and their probabilities.  Outcomes that leave the state
+ * unchanged are dropped and the rest rescaled to cover them.
+ */
+ProbState SpinNode::outcomes (const SpinOperator spin_op[]) const
+{
+	ProbState next{ spin_op[spin_count()] * state };
+	auto self = next.terms.find (state);
+	if (self != next.terms.end())
+	{
+		//clog << state << " did not change when applying " << spin_op + max_spins << '\n';
+		Prob coverage = 1.0 - self->second;
+		next.terms.erase (self);
+		for (auto& term : next.terms)
+			term.second /= coverage;
+	}
+	return next;
+}
+
+/**
+ * Expanding a spinning node means to create a branch for each possible
+ * outcome of spinning the board.
  *
  * If the passed spin optimization is enabled, then if the current player
  * has passed spins, more than 1 spin at a time can be computed (up to
  * the point that a whammy is applied, at which point commutativity breaks).
- *
- * This function also supports "partial scan" using the width parameter of
- * the stop condition.  When width==1, only non-plus-a-spin results are
- * scanned; this gives decent coverage for much less processing.
  */
-void SpinNode::scan_branches (const Search& search, const StopCondition& stop)
+void SpinNode::expand (const Search& search)
 {
+	PERF_SCOPE(PERF_SCAN_BRANCHES);
 	payoff_.invalidate ();
 
 	if (branches.empty())
 	{
-		unsigned int max_spins;
-		if (opt_passed_spin_merge && state.up().passed > 0)
-			max_spins = min(static_cast<int> (state.up().passed), 5);
+		for (const auto& s : outcomes (search.spin_op).terms)
+		{
+			Node *child = search.node_cache_->create_node (s.first);
+			child->link();
+			branches.push_back (Branch{s.second, child});
+		}
+	}
+}
+
+/* Outcomes of one spin node grouped by state, for update_branches.  The
+table is open-addressed and reused from node to node; only the slots
+used are cleared.  node is the existing child for the state, if any. */
+struct OutcomeTable
+{
+	struct Slot
+	{
+		State state;
+		Prob prob;
+		Node *node;
+		bool used;
+	};
+	std::vector<Slot> slots;
+	std::vector<uint32_t> used;
+
+	void reset (size_t count)
+	{
+		for (uint32_t i : used)
+			slots[i].used = false;
+		used.clear ();
+		size_t size = 64;
+		while (size < 2 * count)
+			size *= 2;
+		if (slots.size() < size)
+			slots.assign (size, Slot{ State{}, 0.0, nullptr, false });
+	}
+
+	static size_t hash (const State& ds)
+	{
+		uint32_t w[3];
+		memcpy (w, &ds, sizeof(w));
+		uint64_t h = (uint64_t(w[1]) << 32 | w[0]) * 0x9e3779b97f4a7c15ULL;
+		h ^= uint64_t(w[2]) * 0xc2b2ae3d27d4eb4fULL;
+		return h ^ (h >> 29);
+	}
+
+	/* The slot of ds, or a free slot where it belongs */
+	Slot& find (const State& ds)
+	{
+		size_t mask = slots.size() - 1;
+		size_t i = hash (ds) & mask;
+		while (slots[i].used && !(slots[i].state == ds))
+			i = (i + 1) & mask;
+		return slots[i];
+	}
+
+	void add (const State& ds, Prob prob)
+	{
+		Slot& slot = find (ds);
+		if (slot.used)
+			slot.prob += prob;
 		else
-			max_spins = 1;
+		{
+			slot = Slot{ ds, prob, nullptr, true };
+			used.push_back (&slot - slots.data());
+		}
+	}
+};
+
+/**
+ * Bring the branches up to date after the board has changed.  If the
+ * outcomes reach the same states as before, only the probabilities are
+ * rewritten.  Otherwise the branches are rebuilt: the children of states
+ * that are still reached are kept with their links, new states get nodes
+ * from the cache, which the next scan expands if they are new, and old
+ * children that lost their last link are added to orphans.  Returns which
+ * of the two was done, if any.
+ */
+BranchUpdate SpinNode::update_branches (const Search& search, std::vector<Node *>& orphans)
+{
+	if (branches.empty())
+		return BRANCHES_SAME;
+
+	/* This runs for every spin node, so rather than building a ProbState
+	each time, the outcomes are grouped in a reused table.  The
+	probabilities of each state are added in term order, as ProbState
+	does, so that they round the same way. */
+	static thread_local OutcomeTable table;
+	const auto& terms = search.spin_op[spin_count()].expr.terms;
+	table.reset (terms.size());
+	for (const auto& term : terms)
+		table.add (term.first * state, term.second);
+
+	Prob coverage = 1.0;
+	size_t count = table.used.size();
+	OutcomeTable::Slot& self = table.find (state);
+	if (self.used)
+	{
+		coverage = 1.0 - self.prob;
+		count--;
+	}
+	auto prob = [&] (const OutcomeTable::Slot& slot) {
+		return self.used ? slot.prob / coverage : slot.prob;
+	};
 
-		ProbState next{ search.spin_op[max_spins] * state };
-		Prob coverage = 1.0;
-		for (const auto& s : next.terms)
+	/* Match each branch to the slot of its state.  The states are the
+	same if every branch finds its own and there are no others. */
+	size_t kept = 0;
+	for (const auto& branch : branches)
+	{
+		OutcomeTable::Slot& slot = table.find (branch.second->state);
+		if (slot.used && &slot != &self)
 		{
-			if (s.first == state)
-			{
-				//clog << state << " did not change when applying " << search.spin_op + max_spins << '\n';
-				coverage -= s.second;
-			}
-			else
-			{
-				branches.push_back (Branch{s.second, search.node_cache_->create_node (s.first)});
-			}
+			slot.node = branch.second;
+			kept++;
 		}
-		if (coverage < 1.0)
+	}
+
+	if (kept == branches.size() && kept == count)
+	{
+		bool changed = false;
+		for (auto& branch : branches)
 		{
-			for (auto& branch : branches)
+			Prob p = prob (table.find (branch.second->state));
+			if (branch.first != p)
 			{
-				auto& prob = branch.first;
-				prob /= coverage;
+				branch.first = p;
+				changed = true;
 			}
 		}
+		return changed ? BRANCHES_REWEIGHTED : BRANCHES_SAME;
 	}
 
-	for (auto& branch : branches)
+	/* Rebuild in the order the states were first reached */
+	for (const auto& branch : branches)
 	{
-		Node *node = branch.second;
-		node->scan (search, stop);
+		const OutcomeTable::Slot& slot = table.find (branch.second->state);
+		if (!(slot.used && slot.node == branch.second) && branch.second->unlink())
+			orphans.push_back (branch.second);
 	}
-}
-
-/**
- * The payoff for a SpinNode is the weighted sum of the payoffs of
- * each of the spin outcomes.
- */
-void SpinNode::calc_payoff () const
-{
-	payoff_.clear ();
-	for (auto& branch : branches)
+	branches.clear ();
+	for (uint32_t i : table.used)
 	{
-		auto& node = branch.second;
-		auto& prob = branch.first;
-		Payoff p = node->payoff();
-		p *= prob;
-		payoff_ += p;
+		OutcomeTable::Slot& slot = table.slots[i];
+		if (&slot == &self)
+			continue;
+		Node *child = slot.node;
+		if (!child)
+		{
+			child = search.node_cache_->create_node (slot.state);
+			child->link();
+		}
+		branches.push_back (Branch{prob (slot), child});
 	}
+	return BRANCHES_REBUILT;
 }
 
 /*********************************************************************/
 
 /**
- * Scanning a decision node means to scan both options (pass or play).
+ * Expanding a decision node means to create both options (pass or play).
  *
  * As the same node can be scanned more than once, check if the child
  * nodes already exist before creating.
@@ -359,8 +1615,9 @@ void SpinNode::calc_payoff () const
  * If third place spin optimization is enabled (as it should be), then
  * always play.
  */
-void DecideNode::scan_branches (const Search& search, const StopCondition& stop)
+void DecideNode::expand (const Search& search)
 {
+	PERF_SCOPE(PERF_SCAN_BRANCHES);
 	payoff_.invalidate ();
 	SearchResult result;
 	const SearchOptions& options = search.options();
@@ -368,22 +1625,39 @@ void DecideNode::scan_branches (const Search& search, const StopCondition& stop)
 	/* if (solved (result, options))
 		return; */
 	if (!if_pass && !if_play)
-	{
-		if (options.max_lead && state.lead() > options.max_lead)
-			;
-		else
-			if_play = search.node_cache_->create_spin_node (state);
+		add_choices (search, options);
+}
 
-		if (options.always_spin_third_place && state.third_place())
-			;
-		else
-			if_pass = search.node_cache_->create_node (search.pass_op * state);
+void DecideNode::add_choices (const Search& search, const SearchOptions& options)
+{
+	if (!if_play && can_play (options))
+	{
+		if_play = search.node_cache_->create_spin_node (state);
+		if_play->link();
 	}
+	if (!if_pass && can_pass (options))
+	{
+		if_pass = search.node_cache_->create_node (search.pass_op * state);
+		if_pass->link();
+	}
+}
 
-	if (if_play)
-		if_play->scan (search, stop);
-	if (if_pass)
-		if_pass->scan (search, stop);
+bool DecideNode::can_play (const SearchOptions& options) const
+{
+	return !(options.max_lead && state.lead() > options.max_lead) && ruled (options) != PASS;
+}
+
+bool DecideNode::can_pass (const SearchOptions& options) const
+{
+	return !(options.always_spin_third_place && state.third_place()) && ruled (options) != PLAY;
+}
+
+DecideNode::Decision DecideNode::ruled (const SearchOptions& options) const
+{
+	if (!options.move_rules || (options.max_lead && state.lead() > options.max_lead) ||
+		(options.always_spin_third_place && state.third_place()))
+		return UNDECIDED;
+	return options.move_rules->match (state);
 }
 
 /**
@@ -402,6 +1676,7 @@ void DecideNode::scan_branches (const Search& search, const StopCondition& stop)
  */
 void DecideNode::calc_payoff () const
 {
+	PERF_SCOPE(PERF_CALC_PAYOFF);
 	if (!if_play && !if_pass)
 		payoff_.clear ();
 	else if (!if_play)
@@ -420,6 +1695,8 @@ void DecideNode::calc_payoff () const
 		else
 			payoff_ = merge(if_pass->payoff(), if_play->payoff());
 	}
+	if constexpr (trace_level >= TRACE_PAYOFF)
+		trace<TRACE_PAYOFF> (TRACE_DECIDED, state, 0, decision(), payoff_.prob.data());
 
 	if (debug)
 	{
@@ -1,16 +1,19 @@
 #ifndef __PYL_SEARCH_H
 #define __PYL_SEARCH_H
 
+#include <chrono>
 #include <ostream>
 #include <vector>
-#ifdef MAP_CACHE
-#include <map>
-#else
-#include <unordered_map>
+#ifdef __SSE__
+#include <immintrin.h>
 #endif
+#include <deque>
+#include <unordered_map>
 
 #include "pyl.hpp"
 #include "interval.hpp"
+#include "pyl_memory.hpp"
+#include "pyl_profile.hpp"
 
 namespace pyl {
 
@@ -20,8 +23,15 @@ struct Payoff
 	a std:array.  A Payoff may also be nullptr-like, to denote when the
 	payoff has not yet been computed.  As probabilities are always positive,
 	the null case is implemented by storing a negative number in the first
-	element. */
-	array<Prob, num_players> prob;
+	element.
+	   The array is padded to 4 lanes so that a Payoff fills exactly one
+	SSE register; the lane after the last player is always zero.  The
+	lanes are loaded and stored unaligned rather than declaring the struct
+	alignas(16): that would grow every Node by 8 bytes of padding, and
+	unaligned access to aligned data costs nothing extra. */
+	static constexpr size_t Lanes = 4;
+	static_assert (num_players < Lanes, "Payoff needs a spare lane");
+	array<Prob, Lanes> prob;
 
 	static constexpr Prob null_value = -1.0;
 
@@ -30,7 +40,7 @@ struct Payoff
 
 	/* Constructing with an integer N initializes the win percentage
 	for player N to 1, and all other players to 0. */
-	Payoff (size_t n) { prob[n] = 1.0; }
+	Payoff (size_t n) : prob{} { prob[n] = 1.0; }
 
 	void invalidate () { clear(); prob[0] = null_value; }
 
@@ -50,6 +60,42 @@ struct Payoff
 
 	void assign (size_t n, Prob value) { prob[n] = value; }
 
+#ifdef __SSE__
+	__m128 load () const { return _mm_loadu_ps (prob.data()); }
+	void store (__m128 v) { _mm_storeu_ps (prob.data(), v); }
+
+	/* Multiply-add of all lanes: acc + v * w */
+	static __m128 fma (__m128 acc, __m128 v, __m128 w)
+	{
+#ifdef __FMA__
+		return _mm_fmadd_ps (v, w, acc);
+#else
+		return _mm_add_ps (acc, _mm_mul_ps (v, w));
+#endif
+	}
+	static __m128 fma (__m128 acc, __m128 v, Prob w) { return fma (acc, v, _mm_set1_ps (w)); }
+
+	Payoff& operator+= (const Payoff& other) {
+		store (_mm_add_ps (load(), other.load()));
+		return *this;
+	}
+
+	Payoff& operator*= (Prob p) {
+		store (_mm_mul_ps (load(), _mm_set1_ps (p)));
+		return *this;
+	}
+
+	bool operator== (const Payoff& other) const {
+		return _mm_movemask_ps (_mm_cmpeq_ps (load(), other.load())) == 0xf;
+	}
+
+	/* Lane-wise minimum */
+	static Payoff min (const Payoff& p1, const Payoff& p2) {
+		Payoff res;
+		res.store (_mm_min_ps (p1.load(), p2.load()));
+		return res;
+	}
+#else
 	Payoff& operator+= (const Payoff& other) {
 		for (size_t i=0; i < prob.size(); ++i) {
 			prob[i] += other.prob[i];
@@ -64,13 +110,21 @@ struct Payoff
 		return *this;
 	}
 
-	bool operator== (const Payoff& other) {
+	bool operator== (const Payoff& other) const {
 		for (size_t i=0; i < prob.size(); ++i)
 			if (prob[i] != other.prob[i])
 				return false;
 		return true;
 	}
 
+	static Payoff min (const Payoff& p1, const Payoff& p2) {
+		Payoff res;
+		for (size_t i=0; i < Lanes; ++i)
+			res.prob[i] = std::min (p1.prob[i], p2.prob[i]);
+		return res;
+	}
+#endif
+
 	/* range(N) returns the probability of player N winning, expressed
 	as an interval */
 	Interval<Prob> range(size_t n) const
@@ -79,6 +133,8 @@ struct Payoff
 	}
 };
 
+struct MoveRules;
+
 struct SearchOptions
 {
 	Prob max_uncertainty;
@@ -89,10 +145,18 @@ struct SearchOptions
 	unsigned int always_spin_third_place : 1;
 	unsigned int merge_passed_spins : 1;
 	unsigned int optimize_final_spin : 1;
+	unsigned int sweep_payoff : 1; /* evaluate payoffs with PayoffSweep */
+	unsigned int breadth_first : 1; /* scan a level at a time (Search::scan_levels) */
+	unsigned int compact : 2; /* CompactOrder of the nodes after each iteration; 0 is off */
+	unsigned int freeze : 1; /* release the graph below settled nodes before each iteration (NodeCache::freeze) */
+	unsigned int memory_budget; /* in megabytes; 0 means no limit */
+	unsigned int profile_sample; /* profile 1 in N node lookups; 0 is off */
+	const MoveRules *move_rules; /* below the root, create only the choice a mined rule dictates (pyl_rules.hpp); null is off */
 
 	SearchOptions() : max_uncertainty(0.03), max_lead(15000), max_depth(50),
 		max_passed_spins_optimized(7), debug(false), always_spin_third_place(true),
-		merge_passed_spins(true), optimize_final_spin(false)
+		merge_passed_spins(true), optimize_final_spin(false), sweep_payoff(false), breadth_first(false), compact(0), freeze(true), memory_budget(0),
+		profile_sample(0), move_rules(nullptr)
 	{
 	}
 };
@@ -110,58 +174,143 @@ struct StopCondition
 };
 
 struct NodeCache;
+struct Node;
 struct DecideNode;
+struct SpinPowers;
+struct CheckpointWriter;
+struct ResultSink;
 
 struct Search
 {
 	static const int MaxPassedSpins = 7;
 
 	Search (const SpinOperator& spin, const SearchOptions& options);
+	Search (const SpinPowers& powers, const SearchOptions& options);
 	~Search ();
 
 	const SearchOptions& options() const { return options_; }
 	SearchResult& result() { return result_; }
 
 	DecideNode *run(State init);
-
-	const SpinOperator spin_op[MaxPassedSpins];
+	size_t update_board (const SpinOperator& spin);
+	DecideNode *resolve (State init);
+
+	/* Checkpoint the graph to path after each iteration of run, at most
+	once every interval seconds, in the background (see pyl_checkpoint.hpp) */
+	void checkpoint (const std::string& path, unsigned int interval);
+	/* Load a checkpoint into a new search; run of the same root then
+	continues after the checkpointed depth.  Returns false on error. */
+	bool resume (const std::string& path);
+	/* Push a ResultRecord into sink at the end of each run, or stop if
+	null (see pyl_results.hpp).  The sink must outlive the runs. */
+	void results (ResultSink *sink) { results_ = sink; }
+
+	SpinOperator spin_op[MaxPassedSpins];
 	const PassOperator pass_op;
-	mutable NodeCache *node_cache_;
+	mutable NodeCache *node_cache_ = nullptr;
 private:
+	/* The common part of the public constructors, which fill spin_op */
+	explicit Search (const SearchOptions& options);
+	void scan_levels (Node *root, int depth);
+	void record (State init, const DecideNode *node, bool solved,
+		std::chrono::steady_clock::time_point start) const;
+
 	const SearchOptions options_;
 	SearchResult result_;
+	int last_depth_ = 0; /* depth of the last iteration of run */
+	/* Spin nodes whose branches update_board rebuilt or thawed, which
+	resolve must scan again */
+	std::vector<State> rescan_;
+	std::unique_ptr<CheckpointWriter> checkpoint_;
+	unsigned int checkpoint_interval_ = 0;
+	std::chrono::steady_clock::time_point last_checkpoint_;
+	State resume_root_{};
+	int resume_depth_ = 0; /* depth of the loaded checkpoint, if any */
+	ResultSink *results_ = nullptr;
 };
 
+enum NodeKind : uint32_t { NODE_TERMINAL, NODE_DECIDE, NODE_SPIN };
+
+/* What SpinNode::update_branches did to a node's branches */
+enum BranchUpdate { BRANCHES_SAME, BRANCHES_REWEIGHTED, BRANCHES_REBUILT };
+
 struct Node
 {
 	State state;
 	mutable Payoff payoff_;
 
-	Node (State ds) : state(ds), payoff_(), visited_(false) {}
+	Node (State ds, NodeKind kind) : state(ds), payoff_(), depth_(0), kind_(kind), frozen_(false), pinned_(false), parents_(0) {}
 	virtual ~Node () {}
+
+	/* All node objects are charged to MEM_NODES.  The sized delete receives
+	the size of the most derived type via the virtual destructor. */
+	static void *operator new (size_t size)
+	{
+		MemoryStats::add (MEM_NODES, size);
+		return PageHeap::allocate (size);
+	}
+	static void operator delete (void *p, size_t size)
+	{
+		MemoryStats::remove (MEM_NODES, size);
+		PageHeap::deallocate (p, size);
+	}
+
+	/* Both walk the graph below this node with an explicit stack, so the
+	depth of the graph is not limited by the call stack */
 	void scan (const Search& search, const StopCondition& stop);
 	const Payoff& payoff () const;
 
-	bool visited() const { return visited_; }
-	void visited(bool v) { visited_ = v; }
+	/* The most remaining depth that the node has been scanned with in
+	this iteration, or -1 if it has not been reached */
+	int depth() const { return int (depth_) - 1; }
+	void depth(int d) { depth_ = d + 1; }
+	bool visited() const { return depth_ != 0; }
+	void visited(bool v) { depth_ = v; }
 	void invalidate() { visited(false); }
+	NodeKind kind() const { return NodeKind (kind_); }
+
+	/* A frozen node has a final payoff, and is not scanned again.  A
+	frozen spin node has no branches left (NodeCache::freeze). */
+	bool frozen() const { return frozen_; }
+	void frozen(bool f) { frozen_ = f; }
+
+	/* Count a link to this node from a spin or decide node.  The count
+	sticks once it reaches its maximum. */
+	void link() { if (parents_ != MaxParents) parents_++; }
+	/* Remove a link; returns true if it was the last one */
+	bool unlink() { return parents_ != 0 && parents_ != MaxParents && --parents_ == 0; }
+	bool linked() const { return parents_ != 0; }
+	/* The number of links, which is at least the number of parents, or
+	MaxParents once the count has stuck */
+	unsigned int links() const { return parents_; }
+	static constexpr uint16_t MaxParents = UINT16_MAX;
+	/* Hold one link for good, so that the node is never released, as
+	for the root of a run (Search::run).  Pinning again does nothing. */
+	void pin() { if (!pinned_) { pinned_ = true; link(); } }
+	bool pinned() const { return pinned_; }
 
 	virtual void print (ostream& os) const = 0;
-	virtual void scan_branches (const Search& search, const StopCondition& stop) = 0;
-	virtual void calc_payoff () const = 0;
+	/* Invalidate the payoff, and create the branches if there are none */
+	virtual void expand (const Search& search) = 0;
 
 private:
-	bool visited_;
+	void calc_payoffs () const;
+
+	uint8_t depth_;  /* depth() + 1 */
+	uint8_t kind_ : 2;
+	uint8_t frozen_ : 1;
+	uint8_t pinned_ : 1;
+	uint16_t parents_;
 };
 
 struct TerminalNode : public Node
 {
-	TerminalNode (State ds) : Node(ds) {}
+	TerminalNode (State ds) : Node(ds, NODE_TERMINAL) {}
 	virtual ~TerminalNode() {}
 
 	virtual void print (ostream& os) const override ;
-	virtual void scan_branches (const Search& search, const StopCondition& stop) override;
-	virtual void calc_payoff () const override;
+	virtual void expand (const Search& search) override;
+	void calc_payoff () const;
 };
 
 struct DecideNode : public Node
@@ -171,45 +320,120 @@ struct DecideNode : public Node
 
 	enum Decision { UNDECIDED, PLAY, PASS };
 
-	DecideNode (State ds) : Node(ds), if_play(nullptr), if_pass(nullptr) {}
+	DecideNode (State ds) : Node(ds, NODE_DECIDE), if_play(nullptr), if_pass(nullptr) {}
 	virtual ~DecideNode() {}
 
 	virtual void print (ostream& os) const override;
-	virtual void scan_branches (const Search& search, const StopCondition& stop) override;
-	virtual void calc_payoff () const override;
+	virtual void expand (const Search& search) override;
+	/* Compute the payoff from those of the choices, which must be known */
+	void calc_payoff () const;
 	Decision decision() const;
 	bool solved (SearchResult&, const SearchOptions&) const;
+	/* Create the choices that options allow and that do not exist yet */
+	void add_choices (const Search& search, const SearchOptions& options);
+	/* Whether each choice is created when the node is expanded */
+	bool can_play (const SearchOptions& options) const;
+	bool can_pass (const SearchOptions& options) const;
+	/* The choice that options.move_rules dictates, or UNDECIDED if none
+	does or the other choices leave only one anyway */
+	Decision ruled (const SearchOptions& options) const;
 
 };
 
 struct SpinNode : public Node
 {
 	typedef pair<Prob, Node *> Branch;
-	vector<Branch> branches;
+	vector<Branch, TrackingAllocator<Branch, MEM_BRANCHES>> branches;
 
-	SpinNode (State ds) : Node(ds) {}
+	SpinNode (State ds) : Node(ds, NODE_SPIN) {}
+	SpinNode (const SpinNode&) = default;
 	virtual ~SpinNode() {}
 	virtual void print (ostream& os) const override;
-	virtual void scan_branches (const Search& search, const StopCondition& stop) override;
-	virtual void calc_payoff () const override;
+	virtual void expand (const Search& search) override;
+	unsigned int spin_count () const;
+	ProbState outcomes (const SpinOperator spin_op[]) const;
+	BranchUpdate update_branches (const Search& search, std::vector<Node *>& orphans);
+};
+
+/*
+ * NodeCache - owns every node, and finds the node for a state.
+ *
+ * Nodes are found through one open-addressing table keyed by state and
+ * node type (a decide state also has a spin node, for its play choice).
+ * A slot holds the key next to a reference to the node, so a probe reads
+ * a single cache line, and the slot's address is known as soon as the
+ * state is hashed.  create_nodes() uses that to prefetch the slots of a
+ * whole batch of states before resolving any of them.
+ *
+ * Nodes are allocated one at a time as they are created, which scatters
+ * them over the heap.  compact() moves them all into a single block in
+ * the order of a walk of the graph, so that the payoff traversal reads
+ * memory mostly in sequence.
+ *
+ * apply() visits the nodes of each type in the order they were created,
+ * or in their compacted order.
+ */
+/* Order of the nodes after NodeCache::compact */
+enum CompactOrder
+{
+	COMPACT_PREORDER = 1,  /* depth first, parents before their children */
+	COMPACT_POSTORDER = 2, /* depth first, children before their parents */
 };
 
 struct NodeCache
 {
+	struct Request
+	{
+		State state;
+		NodeKind kind;
+	};
+
+	/* The type of node that create_node makes for a state */
+	static NodeKind kind_of (const State& ds)
+	{
+		return ds.terminal() ? NODE_TERMINAL : ds.can_pass() ? NODE_DECIDE : NODE_SPIN;
+	}
+
 	Node *create_node (const State& ds);
 	SpinNode *create_spin_node (const State& ds);
 	DecideNode *create_decide_node (const State& ds);
 	TerminalNode *create_terminal_node (const State& ds);
 
+	/* Find or create the nodes for count requests, storing them in out */
+	void create_nodes (const Request *requests, size_t count, Node **out);
+	/* Find the node of the given type for a state, or null if there is none */
+	Node *find (const State& ds, NodeKind kind) const;
+
+	/* Move every node but the pinned ones into one new block, in the given
+	order of a walk from root, followed by the nodes that root does not
+	reach, and rewrite the links between them.  Pinned nodes stay where
+	they are; any other pointer to a node becomes invalid, so look the node
+	up again by its state.  Every node is left unvisited. */
+	void compact (const Node *root, CompactOrder order);
+	/* Pin a node (Node::pin), first moving it out of the block of the last
+	compact(), so that its address stays valid.  Returns that address. */
+	DecideNode *pin (DecideNode *node);
+	/* size() after the last compact() */
+	size_t compacted () const { return compacted_; }
+
+	/* Freeze every node whose payoff has become final: its uncertainty
+	is no more than limit.  A frozen spin node drops its branches, and the
+	nodes that no other node links to any more are destroyed.  Pinned
+	nodes are kept.  Returns the number destroyed. */
+	size_t freeze (Prob limit);
+	/* Destroy the nodes in orphans that no node links to any more, and
+	the nodes below them that lose their last link.  Returns the number
+	destroyed. */
+	size_t release_orphans (std::vector<Node *>& orphans);
+	/* Invalidate the payoffs of the nodes in changed and of every node
+	above them, whose payoffs depend on theirs.  Returns the number
+	invalidated. */
+	size_t invalidate_above (const std::vector<Node *>& changed);
+
 	unsigned int final_spin_nodes = 0;
-	explicit NodeCache () {
-#ifdef MAP_CACHE
-#else
-		//spin_nodes_.reserve (250000);
-		//decide_nodes_.reserve (250000);
-#endif
-	}
-	~NodeCache () = default;
+	std::unique_ptr<HotStateProfiler> profiler;
+	NodeCache () = default;
+	~NodeCache ();
 	NodeCache (const NodeCache&) = delete;
 	NodeCache& operator= (const NodeCache&) = delete;
 
@@ -217,41 +441,70 @@ struct NodeCache
 
 	void apply(std::function<void(Node *)> f)
 	{
-		for (auto& elem : spin_nodes_)
-			f(elem.second.get());
-		for (auto& elem : decide_nodes_)
-			f(elem.second.get());
-		for (auto& elem : terminal_nodes_)
-			f(elem.second.get());
+		for (auto node : spin_nodes_)
+			f(node);
+		for (auto node : decide_nodes_)
+			f(node);
+		for (auto node : terminal_nodes_)
+			f(node);
 	}
 
 	void print()
 	{
 		clog << "Node cache:\n";
-		for (auto& elem : spin_nodes_)
+		for (auto node : spin_nodes_)
 		{
-			auto& node = elem.second;
 			node->print (clog);
 			clog << '\n';
 		}
-		for (auto& elem : decide_nodes_)
+		for (auto node : decide_nodes_)
 		{
-			auto& node = elem.second;
 			node->print (clog);
 			clog << '\n';
 		}
 	}
 
 private:
-#ifdef MAP_CACHE
-	map<State, std::unique_ptr<SpinNode>> spin_nodes_;
-	map<State, std::unique_ptr<DecideNode>> decide_nodes_;
-	map<State, std::unique_ptr<TerminalNode>> terminal_nodes_;
-#else
-	unordered_map<State, std::unique_ptr<SpinNode>> spin_nodes_;
-	unordered_map<State, std::unique_ptr<DecideNode>> decide_nodes_;
-	unordered_map<State, std::unique_ptr<TerminalNode>> terminal_nodes_;
-#endif
+	/* ref is the node type in the top two bits and one more than the
+	node's position in its list below them, or 0 for an empty slot */
+	struct Slot
+	{
+		State state;
+		uint32_t ref;
+	};
+	static constexpr unsigned int KindShift = 30;
+
+	template <class N>
+	using NodeList = std::deque<N *, TrackingAllocator<N *, MEM_BUCKETS>>;
+
+	static size_t hash (const State& ds, NodeKind kind);
+	/* Make room for count more nodes without growing the table */
+	void reserve (size_t count);
+	/* Store a slot known not to be in the table */
+	void place (const Slot& slot);
+	Node *find_or_create (const State& ds, NodeKind kind, size_t h);
+	Node *node_at (uint32_t ref) const;
+	/* The position in slots_ of a node in the table */
+	size_t slot_of (const Node *node) const;
+	bool in_arena (const Node *node) const
+	{
+		const char *p = reinterpret_cast<const char *> (node);
+		return p >= arena_ && p < arena_ + arena_bytes_;
+	}
+	/* Destroy a node, which is either in the arena or on the heap */
+	void release (Node *node);
+	size_t release_unlinked (std::vector<Node *>& dead);
+
+	std::vector<Slot, TrackingAllocator<Slot, MEM_BUCKETS>> slots_;
+	size_t used_ = 0;
+	NodeList<SpinNode> spin_nodes_;
+	NodeList<DecideNode> decide_nodes_;
+	NodeList<TerminalNode> terminal_nodes_;
+	/* The block of the last compact(), which holds the nodes created before
+	it; nodes created since, and pinned nodes, are on the heap */
+	char *arena_ = nullptr;
+	size_t arena_bytes_ = 0;
+	size_t compacted_ = 0;
 };
 
 template<class T>
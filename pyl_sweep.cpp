@@ -0,0 +1,315 @@
+
+#include <unordered_map>
+
+#include "pyl_sweep.hpp"
+
+namespace pyl {
+
+namespace {
+
+enum Kind : uint8_t { INPUT, SPIN, DECIDE };
+
+/* Slot value for a node whose subtree is still being compiled */
+constexpr PayoffSweep::Slot InProgress = PayoffSweep::NoChild - 1;
+
+struct Frame
+{
+	const Node *node;
+	Kind kind;
+	uint32_t next_child;
+};
+
+Kind kind_of (const Node *node)
+{
+	if (node->kind() == NODE_SPIN)
+		return SPIN;
+	if (node->kind() == NODE_DECIDE)
+		return DECIDE;
+	return INPUT;
+}
+
+/* Return the n'th child in the order that calc_payoff visits them, or
+nullptr past the end.  A missing decide choice is also nullptr. */
+const Node *child (const Node *node, Kind kind, uint32_t n, bool& end)
+{
+	end = false;
+	if (kind == SPIN)
+	{
+		const auto& branches = static_cast<const SpinNode *> (node)->branches;
+		if (n < branches.size())
+			return branches[n].second;
+	}
+	else if (n < 2)
+	{
+		const DecideNode *d = static_cast<const DecideNode *> (node);
+		return n == 0 ? d->if_play : d->if_pass;
+	}
+	end = true;
+	return nullptr;
+}
+
+} // namespace
+
+/**
+ * Build the level-ordered form of the graph below root.
+ *
+ * The walk is an iterative depth-first search that follows only nodes
+ * without a payoff, visiting children in calc_payoff order.  Nodes finish
+ * in post-order, which is a valid evaluation order, and each node's level
+ * is one more than the highest level among the children it depends on.
+ * The nodes are then renumbered so that each level occupies consecutive
+ * slots.
+ *
+ * On a cycle the walk reproduces what the recursion computes: a spin node
+ * in progress reads zero, and a decide node in progress is evaluated
+ * again from its children, giving it a second slot.  Only the slot that
+ * finishes last is stored back to the node.
+ */
+void PayoffSweep::compile (Node *root)
+{
+	/* Temporary numbering, in the order that nodes finish */
+	std::unordered_map<const Node *, Slot> temp;
+	std::vector<const Node *> temp_node{ nullptr };
+	std::vector<Kind> temp_kind{ INPUT };
+	std::vector<uint32_t> temp_level{ 0 };
+	std::vector<bool> temp_final{ false };
+	std::vector<uint32_t> edge_begin{ 0, 0 };  /* node t has edges [t, t+1) */
+	std::vector<Slot> edge_child;
+	std::vector<Prob> edge_weight;
+
+	auto add_input = [&] (const Node *node) {
+		/* Terminal payoffs are cheap and never change; compute them here */
+		node->payoff ();
+		temp[node] = temp_node.size ();
+		temp_node.push_back (node);
+		temp_kind.push_back (INPUT);
+		temp_level.push_back (0);
+		temp_final.push_back (false);
+		edge_begin.push_back (edge_child.size ());
+	};
+
+	auto resolve = [&] (const Node *node) -> Slot {
+		if (!node)
+			return NoChild;
+		Slot s = temp.at (node);
+		return s == InProgress ? 0 : s;
+	};
+
+	std::vector<Frame> stack;
+	auto visit = [&] (const Node *node) {
+		if (temp.count (node))
+			return;
+		Kind kind = kind_of (node);
+		if (node->payoff_ || kind == INPUT)
+			add_input (node);
+		else
+		{
+			/* Only spin nodes are marked while in progress.  A decide
+			node that is reached again through a cycle is pushed again,
+			as the recursion evaluates it again. */
+			if (kind == SPIN)
+				temp[node] = InProgress;
+			stack.push_back (Frame{node, kind, 0});
+		}
+	};
+
+	visit (root);
+	while (!stack.empty ())
+	{
+		Frame& f = stack.back ();
+		bool end;
+		const Node *c = child (f.node, f.kind, f.next_child++, end);
+		if (!end)
+		{
+			if (c)
+				visit (c);
+			continue;
+		}
+
+		/* All children done: record this node's edges and level */
+		const Node *node = f.node;
+		Kind kind = f.kind;
+		stack.pop_back ();
+
+		uint32_t level = 0;
+		if (kind == SPIN)
+		{
+			for (const auto& branch : static_cast<const SpinNode *> (node)->branches)
+			{
+				Slot s = resolve (branch.second);
+				edge_child.push_back (s);
+				edge_weight.push_back (branch.first);
+				level = std::max (level, temp_level[s]);
+			}
+		}
+		else
+		{
+			const DecideNode *d = static_cast<const DecideNode *> (node);
+			for (const Node *c : { (const Node *)d->if_play, (const Node *)d->if_pass })
+			{
+				Slot s = resolve (c);
+				edge_child.push_back (s);
+				edge_weight.push_back (0.0);
+				if (s != NoChild)
+					level = std::max (level, temp_level[s]);
+			}
+		}
+
+		/* An earlier instance of a decide node is superseded by this one */
+		auto it = temp.find (node);
+		if (it != temp.end () && it->second != InProgress)
+			temp_final[it->second] = false;
+		temp[node] = temp_node.size ();
+		temp_node.push_back (node);
+		temp_kind.push_back (kind);
+		temp_level.push_back (level + 1);
+		temp_final.push_back (true);
+		edge_begin.push_back (edge_child.size ());
+	}
+
+	/* Renumber: inputs first, then by level, with the spin nodes of each
+	level before its decide nodes.  This is a counting sort on the key
+	2*level + (decide ? 1 : 0). */
+	size_t count = temp_node.size ();
+	uint32_t max_level = *std::max_element (temp_level.begin (), temp_level.end ());
+	std::vector<uint32_t> bucket_start (2 * max_level + 3, 0);
+	auto key = [&] (Slot t) { return 2 * temp_level[t] + (temp_kind[t] == DECIDE); };
+	for (Slot t = 0; t < count; ++t)
+		bucket_start[key (t) + 1]++;
+	for (size_t k = 1; k < bucket_start.size (); ++k)
+		bucket_start[k] += bucket_start[k - 1];
+
+	std::vector<Slot> final_slot (count);
+	std::vector<uint32_t> next (bucket_start);
+	for (Slot t = 0; t < count; ++t)
+		final_slot[t] = next[key (t)]++;
+
+	nodes_.assign (count, nullptr);
+	computed_.assign (count, false);
+	inputs_ = bucket_start[2];
+	values.assign (count, Payoff ());
+	for (Slot t = 0; t < count; ++t)
+	{
+		Slot s = final_slot[t];
+		nodes_[s] = temp_node[t];
+		computed_[s] = temp_final[t];
+		if (temp_kind[t] == INPUT)
+		{
+			if (temp_node[t])
+				values[s] = temp_node[t]->payoff_;
+			else
+				values[s].clear ();
+		}
+	}
+
+	/* Emit the rows and decide entries in slot order */
+	std::vector<Slot> by_slot (count);
+	for (Slot t = 0; t < count; ++t)
+		by_slot[final_slot[t]] = t;
+
+	levels_.clear ();
+	spin_target_.clear ();
+	row_ptr_.assign (1, 0);
+	col_.clear ();
+	weight_.clear ();
+	decide_.clear ();
+
+	auto remap = [&] (Slot s) { return s == NoChild ? NoChild : final_slot[s]; };
+	for (uint32_t level = 1; level <= max_level; ++level)
+	{
+		Level l;
+		l.spin_begin = spin_target_.size ();
+		for (Slot s = bucket_start[2 * level]; s < bucket_start[2 * level + 1]; ++s)
+		{
+			Slot t = by_slot[s];
+			for (uint32_t e = edge_begin[t]; e < edge_begin[t + 1]; ++e)
+			{
+				col_.push_back (remap (edge_child[e]));
+				weight_.push_back (edge_weight[e]);
+			}
+			spin_target_.push_back (s);
+			row_ptr_.push_back (col_.size ());
+		}
+		l.spin_end = spin_target_.size ();
+
+		l.decide_begin = decide_.size ();
+		for (Slot s = bucket_start[2 * level + 1]; s < bucket_start[2 * level + 2]; ++s)
+		{
+			Slot t = by_slot[s];
+			uint32_t e = edge_begin[t];
+			decide_.push_back (DecideEntry{s, remap (edge_child[e]), remap (edge_child[e + 1]),
+				temp_node[t]->state.up_num()});
+		}
+		l.decide_end = decide_.size ();
+		levels_.push_back (l);
+	}
+}
+
+/**
+ * Compute all payoffs, one level at a time.  The arithmetic matches
+ * SpinNode::calc_payoff and DecideNode::calc_payoff exactly.
+ */
+void PayoffSweep::evaluate ()
+{
+	for (const Level& l : levels_)
+	{
+		for (uint32_t r = l.spin_begin; r < l.spin_end; ++r)
+		{
+#ifdef __SSE__
+			__m128 acc = _mm_setzero_ps ();
+			for (uint32_t e = row_ptr_[r]; e < row_ptr_[r + 1]; ++e)
+				acc = Payoff::fma (acc, values[col_[e]].load (), weight_[e]);
+			values[spin_target_[r]].store (acc);
+#else
+			Payoff& out = values[spin_target_[r]];
+			out.clear ();
+			for (uint32_t e = row_ptr_[r]; e < row_ptr_[r + 1]; ++e)
+			{
+				Payoff p = values[col_[e]];
+				p *= weight_[e];
+				out += p;
+			}
+#endif
+		}
+
+		for (uint32_t n = l.decide_begin; n < l.decide_end; ++n)
+		{
+			const DecideEntry& d = decide_[n];
+			Payoff& out = values[d.target];
+			if (d.play == NoChild && d.pass == NoChild)
+				out.clear ();
+			else if (d.play == NoChild)
+				out = values[d.pass];
+			else if (d.pass == NoChild)
+				out = values[d.play];
+			else
+			{
+				const Payoff& play = values[d.play];
+				const Payoff& pass = values[d.pass];
+				if (play[d.up] > pass[d.up])
+					out = play;
+				else if (pass[d.up] > play[d.up])
+					out = pass;
+				else
+					out = Payoff::min (pass, play);
+			}
+		}
+	}
+}
+
+PayoffSweep::Slot PayoffSweep::find (const Node *node) const
+{
+	for (Slot s = 1; s < nodes_.size (); ++s)
+		if (nodes_[s] == node && (s < inputs_ || computed_[s]))
+			return s;
+	return NoChild;
+}
+
+void PayoffSweep::store () const
+{
+	for (size_t s = 0; s < nodes_.size (); ++s)
+		if (computed_[s])
+			nodes_[s]->payoff_ = values[s];
+}
+
+} // namespace pyl
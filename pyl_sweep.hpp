@@ -0,0 +1,83 @@
+#ifndef __PYL_SWEEP_H
+#define __PYL_SWEEP_H
+
+#include <cstdint>
+#include <vector>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * PayoffSweep - evaluates payoffs over a frozen graph as a sequence of
+ * array sweeps, instead of by the depth first traversal of Node::payoff().
+ *
+ * compile() walks the nodes below a root that need a payoff, in the same
+ * order that the recursive evaluation would, and sorts them into levels
+ * such that every node depends only on lower levels.  Each level is then
+ * a sparse matrix-vector product for its spin nodes (CSR rows of branch
+ * probabilities) followed by a gather-and-select for its decide nodes.
+ * Nodes that already have a payoff are inputs to the sweep, not part of it.
+ *
+ * Score saturation can make the graph cyclic.  The sweep gives the same
+ * payoffs as the recursive evaluation does in that case; see compile().
+ *
+ * All nodes within a level are independent of each other.
+ */
+struct PayoffSweep
+{
+	typedef uint32_t Slot;
+	static constexpr Slot NoChild = ~Slot(0);
+
+	struct Level
+	{
+		uint32_t spin_begin, spin_end;
+		uint32_t decide_begin, decide_end;
+	};
+
+	struct DecideEntry
+	{
+		Slot target;
+		Slot play;
+		Slot pass;
+		uint32_t up;
+	};
+
+	void compile (Node *root);
+	void evaluate ();
+
+	/* Write the computed payoffs back to the nodes */
+	void store () const;
+
+	size_t size () const { return nodes_.size(); }
+	size_t levels () const { return levels_.size(); }
+
+	/* Return the slot that holds the payoff of node, or NoChild.  This is
+	a linear search. */
+	Slot find (const Node *node) const;
+
+	/* values[slot] is the payoff of nodes_[slot].  Slot 0 is the constant
+	zero payoff read by cyclic edges. */
+	std::vector<Payoff> values;
+
+private:
+	/* BoardBatch evaluates the same levels with one lane per board */
+	friend struct BoardBatch;
+
+	std::vector<const Node *> nodes_;
+	std::vector<bool> computed_;
+	size_t inputs_ = 0;  /* slots below this are inputs */
+	std::vector<Level> levels_;
+
+	/* Spin nodes: CSR matrix, one row per node */
+	std::vector<Slot> spin_target_;
+	std::vector<uint32_t> row_ptr_;
+	std::vector<Slot> col_;
+	std::vector<Prob> weight_;
+
+	std::vector<DecideEntry> decide_;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_SWEEP_H */
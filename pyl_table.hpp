@@ -0,0 +1,160 @@
+#ifndef __PYL_TABLE_H
+#define __PYL_TABLE_H
+
+#include <array>
+#include <cstddef>
+
+#include "pyl.hpp"
+
+namespace pyl {
+
+/*
+ * Compile-time boards.
+ *
+ * A built-in board never changes, so its table of outcomes, and the powers
+ * of it that Search uses for passed spins, can be computed by the compiler
+ * instead of at startup.  SpinTable<N> is a fixed-size array of N terms,
+ * which SpinPowers::assign copies into the SpinOperators that Search uses.
+ * Only the startup cost is saved: nodes are expanded through those
+ * SpinOperators as for any other board.
+ *
+ * Terms are accumulated in a DenseSpinTable, indexed directly by score,
+ * earned spins and taken spins, since a hash table cannot be used in a
+ * constant expression.  The terms of a SpinTable are in index order, so a
+ * SpinOperator made from one iterates in a different order than one built
+ * at run time, and the sums in its probabilities may round differently in
+ * the last bit.
+ */
+struct SpinTerm
+{
+	SpinValue value;
+	Prob prob;
+};
+
+template <size_t N>
+struct SpinTable
+{
+	std::array<SpinTerm, N> terms;
+
+	static constexpr size_t size () { return N; }
+
+	/* Return the board as a SpinOperator, adding the terms in order */
+	SpinOperator spin_operator () const
+	{
+		SpinOperator res;
+		res.expr.terms.reserve (N);
+		for (const SpinTerm& term : terms)
+			res.expr.add (term.prob, term.value);
+		return res;
+	}
+};
+
+struct DenseSpinTable
+{
+	/* Earned and taken spins are below MaxCount for any power Search uses */
+	static constexpr int MaxCount = 8;
+	static constexpr int Scores = SpinValue::MaxScore / SpinValue::MinScoreUnit + 1;
+	static constexpr size_t Capacity = size_t(Scores) * MaxCount * MaxCount;
+
+	Prob prob[Capacity] {};
+	bool used[Capacity] {};
+
+	static constexpr size_t index (const SpinValue& v)
+	{
+		return (size_t(v.score() / SpinValue::MinScoreUnit) * MaxCount + v.earned()) * MaxCount + v.taken();
+	}
+
+	static constexpr SpinValue value (size_t i)
+	{
+		return SpinValue (int(i / (MaxCount * MaxCount)) * SpinValue::MinScoreUnit,
+			int(i / MaxCount % MaxCount), int(i % MaxCount));
+	}
+
+	constexpr void add (Prob scalar, const SpinValue& term)
+	{
+		size_t i = index (term);
+		prob[i] += scalar;
+		used[i] = true;
+	}
+
+	/* The same helpers as SpinOperator, for board definitions such as
+	SpinFeb85::squares */
+	constexpr void W () { add (1.0, SpinValue(0, 0)); }
+	constexpr void S (int s, Prob p=0.0) { add (1.0+p, SpinValue(s, 0)); }
+	constexpr void SE (int s, Prob p=0.0) { add (1.0+p, SpinValue(s, 1)); }
+	constexpr void P (Prob p=0.0) { S(2500, p); }
+
+	constexpr size_t size () const
+	{
+		size_t res = 0;
+		for (size_t i = 0; i < Capacity; ++i)
+			res += used[i];
+		return res;
+	}
+
+	constexpr void normalize ()
+	{
+		Prob w = 0.0;
+		for (size_t i = 0; i < Capacity; ++i)
+			w += prob[i];
+		for (size_t i = 0; i < Capacity; ++i)
+			prob[i] /= w;
+	}
+
+	/* Compact the used terms into a table; N must be size() */
+	template <size_t N>
+	constexpr SpinTable<N> table () const
+	{
+		SpinTable<N> res{};
+		size_t n = 0;
+		for (size_t i = 0; i < Capacity; ++i)
+			if (used[i])
+				res.terms[n++] = SpinTerm{ value (i), prob[i] };
+		return res;
+	}
+};
+
+/* Compose two boards: the effect of in followed by board, in the same
+order of products as SpinOperator::operator() */
+template <size_t N, size_t M>
+constexpr DenseSpinTable compose (const SpinTable<N>& board, const SpinTable<M>& in)
+{
+	DenseSpinTable res{};
+	for (const SpinTerm& t : in.terms)
+		for (const SpinTerm& u : board.terms)
+			res.add (u.prob * t.prob, u.value * t.value);
+	return res;
+}
+
+/*
+ * SpinPower<Board, Spins> - the board composed with itself Spins times,
+ * for a board defined as a constexpr SpinTable.  Each power is a separate
+ * type, as its number of terms differs.
+ */
+template <const auto& Board, int Spins>
+struct SpinPower
+{
+	static_assert (Spins < DenseSpinTable::MaxCount, "too many spins for DenseSpinTable");
+	static constexpr DenseSpinTable dense = compose (Board, SpinPower<Board, Spins-1>::table);
+	static constexpr auto table = dense.template table<dense.size()> ();
+};
+
+template <const auto& Board>
+struct SpinPower<Board, 1>
+{
+	static constexpr const auto& table = Board;
+};
+
+constexpr DenseSpinTable feb85_dense = [] {
+	DenseSpinTable res{};
+	SpinFeb85::squares (res, SpinFeb85::PC, SpinFeb85::B2, SpinFeb85::M1, SpinFeb85::A2, SpinFeb85::BB);
+	res.normalize ();
+	return res;
+} ();
+
+/* SpinFeb85, computed at compile time */
+inline constexpr SpinTable<feb85_dense.size()> feb85_table = feb85_dense.table<feb85_dense.size()> ();
+
+} // namespace pyl
+
+#endif /* __PYL_TABLE_H */
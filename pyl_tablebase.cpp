@@ -0,0 +1,332 @@
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pyl_tablebase.hpp"
+
+namespace pyl {
+
+namespace {
+
+const char tablebase_magic[8] = { 'P', 'Y', 'L', 'T', 'B', 'A', 'S', 'E' };
+const uint32_t tablebase_version = 1;
+
+/* Bits per key in each level's array, relative to the keys left */
+constexpr double bits_per_key = 2.0;
+
+/* Words of the bit array per rank entry */
+constexpr uint64_t rank_block = 8;
+
+uint64_t mix (uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/* Hash of a state, from which the position in each level is derived */
+uint64_t state_hash (const State& state)
+{
+	uint32_t w[3];
+	memcpy (w, &state, sizeof(w));
+	return mix (mix (uint64_t(w[1]) << 32 | w[0]) ^ w[2]);
+}
+
+/* Position of a state with hash h in a level of size bits.  The product
+maps the hash onto the range without a division. */
+uint64_t position (uint64_t h, uint32_t level, uint64_t size)
+{
+	h = mix (h + 0x9e3779b97f4a7c15ULL * level);
+	return uint64_t((unsigned __int128) h * size >> 64);
+}
+
+/* Number of set bits before pos.  Each block of rank_block words has two
+rank words (rank9, Vigna): the count before the block, and the counts
+before each of words 1..7 within the block in 9-bit fields. */
+uint64_t rank_of (const uint64_t *bits, const uint64_t *ranks, uint64_t pos)
+{
+	uint64_t w = pos >> 6;
+	uint64_t b = w / rank_block, j = w % rank_block;
+	uint64_t res = ranks[2 * b];
+	if (j)
+		res += (ranks[2 * b + 1] >> (9 * (j - 1))) & 0x1ff;
+	return res + __builtin_popcountll (bits[w] & ((uint64_t(1) << (pos & 63)) - 1));
+}
+
+uint64_t rank_words (uint64_t bit_words)
+{
+	return 2 * ((bit_words + rank_block - 1) / rank_block);
+}
+
+/* Check that the levels of a tablebase tile its bit array and that the
+values hold every key.  Lookups index the mapping with these numbers, so a
+corrupt file must be rejected rather than read out of bounds.  The word
+counts must already be bounded by the file size, so that the products
+below cannot wrap. */
+bool valid_layout (const TablebaseHeader& header)
+{
+	if (header.level_begin[0] != 0)
+		return false;
+	for (uint32_t level = 0; level < header.levels; ++level)
+		if (header.level_begin[level + 1] <= header.level_begin[level])
+			return false;
+	return header.level_begin[header.levels] == header.bit_words * 64 &&
+		header.count <= header.value_words * 64 / header.bits;
+}
+
+} // namespace
+
+TablebaseWriter::TablebaseWriter (unsigned int bits) : bits_(bits)
+{
+	if (bits_ < 1 || bits_ > 4)
+		throw std::invalid_argument ("a tablebase stores 1 to 4 bits per state");
+}
+
+void TablebaseWriter::add (const State& state, DecideNode::Decision decision, Prob margin)
+{
+	if (decision == DecideNode::UNDECIDED)
+		return;
+	unsigned int max_level = (1u << (bits_ - 1)) - 1;
+	unsigned int level = 0;
+	if (margin >= 0.005)
+		level = std::min (max_level, 1 + unsigned(std::log2 (margin / 0.005)));
+	entries_[state] = (decision == DecideNode::PASS) | (level << 1);
+}
+
+/* The margin is the distance between the midpoints of the two ranges */
+bool TablebaseWriter::add_solved (const DecideNode *node, const SearchOptions& options)
+{
+	SearchResult result;
+	if (!node->if_play || !node->if_pass || !node->solved (result, options))
+		return false;
+	Prob margin = std::fabs ((result.play_win.min() + result.play_win.max()) -
+		(result.pass_win.min() + result.pass_win.max())) / 2;
+	add (node->state, node->decision(), margin);
+	return true;
+}
+
+size_t TablebaseWriter::add_solved (const Search& search)
+{
+	size_t count = 0;
+	search.node_cache_->apply ([&] (Node *node) {
+		if (node->kind() == NODE_DECIDE &&
+			add_solved (static_cast<const DecideNode *> (node), search.options()))
+			count++;
+	});
+	return count;
+}
+
+/**
+ * Build the levels of the hash.  In each level, every remaining key is
+ * hashed to a bit; the keys alone on their bit are placed, and the rest
+ * go on to the next level.
+ */
+bool TablebaseWriter::write (const std::string& path) const
+{
+	std::vector<State> keys;
+	std::vector<uint64_t> hashes;
+	keys.reserve (entries_.size());
+	hashes.reserve (entries_.size());
+	for (const auto& entry : entries_)
+	{
+		keys.push_back (entry.first);
+		hashes.push_back (state_hash (entry.first));
+	}
+
+	TablebaseHeader header{};
+	memcpy (header.magic, tablebase_magic, sizeof(header.magic));
+	header.version = tablebase_version;
+	header.bits = bits_;
+	header.score_unit = SpinValue::MinScoreUnit;
+	header.count = keys.size();
+
+	std::vector<uint64_t> bits;
+	std::vector<uint64_t> key_pos (keys.size());
+	std::vector<uint32_t> remaining (keys.size());
+	for (uint32_t k = 0; k < keys.size(); ++k)
+		remaining[k] = k;
+
+	uint32_t level = 0;
+	for (; !remaining.empty() && level < TablebaseHeader::MaxLevels; ++level)
+	{
+		uint64_t words = std::max<uint64_t> (1, uint64_t(bits_per_key * remaining.size() + 63) / 64);
+		uint64_t size = words * 64;
+		std::vector<uint64_t> seen (words), collided (words);
+		for (uint32_t k : remaining)
+		{
+			uint64_t p = position (hashes[k], level, size);
+			uint64_t m = uint64_t(1) << (p & 63);
+			collided[p >> 6] |= seen[p >> 6] & m;
+			seen[p >> 6] |= m;
+		}
+
+		header.level_begin[level] = bits.size() * 64;
+		std::vector<uint32_t> next;
+		for (uint32_t k : remaining)
+		{
+			uint64_t p = position (hashes[k], level, size);
+			if (collided[p >> 6] & (uint64_t(1) << (p & 63)))
+				next.push_back (k);
+			else
+				key_pos[k] = bits.size() * 64 + p;
+		}
+		for (uint64_t w = 0; w < words; ++w)
+			bits.push_back (seen[w] & ~collided[w]);
+		remaining.swap (next);
+	}
+	if (!remaining.empty())
+	{
+		clog << path << ": " << remaining.size() << " states left after " << level << " levels\n";
+		return false;
+	}
+	header.levels = level;
+	header.level_begin[level] = bits.size() * 64;
+	header.bit_words = bits.size();
+
+	std::vector<uint64_t> ranks (rank_words (bits.size()));
+	uint64_t total = 0;
+	for (uint64_t w = 0; w < bits.size(); ++w)
+	{
+		uint64_t b = w / rank_block, j = w % rank_block;
+		if (j == 0)
+			ranks[2 * b] = total;
+		else
+			ranks[2 * b + 1] |= (total - ranks[2 * b]) << (9 * (j - 1));
+		total += __builtin_popcountll (bits[w]);
+	}
+
+	header.value_words = (keys.size() * bits_ + 63) / 64;
+	std::vector<uint64_t> values (header.value_words);
+	for (uint32_t k = 0; k < keys.size(); ++k)
+	{
+		uint64_t index = rank_of (bits.data(), ranks.data(), key_pos[k]);
+		uint64_t value = entries_.at (keys[k]);
+		uint64_t bit = index * bits_;
+		values[bit >> 6] |= value << (bit & 63);
+		if ((bit & 63) + bits_ > 64)
+			values[(bit >> 6) + 1] |= value >> (64 - (bit & 63));
+	}
+
+	std::ofstream os (path, std::ios::binary);
+	os.write (reinterpret_cast<const char *> (&header), sizeof(header));
+	os.write (reinterpret_cast<const char *> (bits.data()), bits.size() * sizeof(uint64_t));
+	os.write (reinterpret_cast<const char *> (ranks.data()), ranks.size() * sizeof(uint64_t));
+	os.write (reinterpret_cast<const char *> (values.data()), values.size() * sizeof(uint64_t));
+	if (!os)
+	{
+		clog << path << ": cannot write tablebase\n";
+		return false;
+	}
+	return true;
+}
+
+Tablebase::~Tablebase ()
+{
+	if (map_)
+		munmap (map_, map_size_);
+}
+
+bool Tablebase::open (const std::string& path)
+{
+	int fd = ::open (path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		clog << path << ": cannot open\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat (fd, &st) < 0 || size_t(st.st_size) < sizeof(TablebaseHeader))
+	{
+		close (fd);
+		clog << path << ": not a tablebase\n";
+		return false;
+	}
+	void *map = mmap (nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED)
+	{
+		clog << path << ": cannot map\n";
+		return false;
+	}
+
+	/* Bound the word counts by the file size before multiplying, so that
+	the size they imply cannot wrap around on a crafted header */
+	const TablebaseHeader *header = static_cast<const TablebaseHeader *> (map);
+	size_t size = st.st_size;
+	bool words_fit = header->bit_words <= size / sizeof(uint64_t) &&
+		header->value_words <= size / sizeof(uint64_t);
+	size_t expected = !words_fit ? 0 : sizeof(TablebaseHeader) + (header->bit_words +
+		rank_words (header->bit_words) + header->value_words) * sizeof(uint64_t);
+	if (memcmp (header->magic, tablebase_magic, sizeof(header->magic)) != 0 ||
+		header->version != tablebase_version ||
+		header->score_unit != SpinValue::MinScoreUnit ||
+		header->levels > TablebaseHeader::MaxLevels ||
+		header->bits < 1 || header->bits > 4 ||
+		!words_fit || size != expected ||
+		!valid_layout (*header))
+	{
+		munmap (map, st.st_size);
+		clog << path << ": not a tablebase for this build\n";
+		return false;
+	}
+
+	if (map_)
+		munmap (map_, map_size_);
+	map_ = map;
+	map_size_ = st.st_size;
+	header_ = header;
+	bits_ = reinterpret_cast<const uint64_t *> (header + 1);
+	ranks_ = bits_ + header->bit_words;
+	values_ = bits_ + header->bit_words + rank_words (header->bit_words);
+	return true;
+}
+
+uint64_t Tablebase::index (const State& state) const
+{
+	uint64_t h = state_hash (state);
+	for (uint32_t level = 0; level < header_->levels; ++level)
+	{
+		uint64_t begin = header_->level_begin[level];
+		uint64_t pos = begin + position (h, level, header_->level_begin[level + 1] - begin);
+		if (bit (pos))
+			return rank_of (bits_, ranks_, pos);
+	}
+	return header_->count;
+}
+
+/**
+ * Return the stored advice for a decide state.  The state is normalized
+ * the same way Search::run does, so a state whose player up has no spins
+ * is looked up for the next player.
+ */
+Advice Tablebase::lookup (State state) const
+{
+	Advice res;
+	state.change_player ();
+	uint64_t n = index (state);
+	if (n >= header_->count)
+		return res;
+
+	unsigned int bits = header_->bits;
+	uint64_t bit = n * bits;
+	uint64_t value = values_[bit >> 6] >> (bit & 63);
+	if ((bit & 63) + bits > 64)
+		value |= values_[(bit >> 6) + 1] << (64 - (bit & 63));
+	value &= (1u << bits) - 1;
+
+	res.decision = (value & 1) ? DecideNode::PASS : DecideNode::PLAY;
+	res.confidence = value >> 1;
+	return res;
+}
+
+} // namespace pyl
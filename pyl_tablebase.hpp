@@ -0,0 +1,119 @@
+#ifndef __PYL_TABLEBASE_H
+#define __PYL_TABLEBASE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "pyl_search.hpp"
+
+namespace pyl {
+
+/*
+ * Decision tablebase - the play or pass decision for a set of decide
+ * states, for advice at run time without a search.
+ *
+ * States are indexed by a minimal perfect hash (BBHash, Limasset et al.):
+ * a cascade of bit arrays, where each level holds the keys that did not
+ * collide in it, and the rest move to the next level.  A key's index is
+ * the rank of its bit among all levels, which is found with one popcount
+ * and two rank words per 512-bit block.  Each state then stores 1 to 4
+ * bits: the decision (0 for play, 1 for pass), followed by a confidence
+ * level in the remaining bits.  The hash and its rank words take about 4
+ * bits per state.
+ *
+ * The states themselves are not stored, so a lookup of a state that was
+ * not in the table usually returns the value of some other state, and
+ * only sometimes UNDECIDED.
+ *
+ * The file is a TablebaseHeader, the bit arrays of all levels, two rank
+ * words per 512 bits, then the packed values.
+ */
+struct Advice
+{
+	DecideNode::Decision decision = DecideNode::UNDECIDED;
+	unsigned int confidence = 0;
+};
+
+struct TablebaseWriter
+{
+	/* Store bits bits per state, 1 to 4.  Throws std::invalid_argument
+	for any other width. */
+	explicit TablebaseWriter (unsigned int bits);
+
+	/* Record the decision for a state.  margin is the difference between
+	the up player's chance to win after playing and after passing.  It is
+	stored in bits-1 bits as a confidence level: 0 below 0.5%, then one
+	more for each doubling, up to the largest level that fits. */
+	void add (const State& state, DecideNode::Decision decision, Prob margin);
+
+	/* Record the decision of a decide node if it has both choices and is
+	solved under options, with the margin between them.  Returns true if
+	it was recorded. */
+	bool add_solved (const DecideNode *node, const SearchOptions& options);
+
+	/* Record the decisions of every solved decide node in a search that
+	has both choices.  Returns the number of nodes recorded. */
+	size_t add_solved (const Search& search);
+
+	size_t size () const { return entries_.size(); }
+	const std::unordered_map<State, uint8_t>& entries () const { return entries_; }
+
+	/* Build the hash and write the file.  Returns false on error. */
+	bool write (const std::string& path) const;
+
+private:
+	unsigned int bits_;
+	std::unordered_map<State, uint8_t> entries_;
+};
+
+struct TablebaseHeader
+{
+	static constexpr uint32_t MaxLevels = 32;
+
+	char magic[8];
+	uint32_t version;
+	uint32_t bits;
+	uint32_t levels;
+	uint32_t score_unit;
+	uint64_t count;
+	uint64_t bit_words;
+	uint64_t value_words;
+	/* Level l covers bits level_begin[l] up to level_begin[l+1] */
+	uint64_t level_begin[MaxLevels + 1];
+};
+
+struct Tablebase
+{
+	Tablebase () = default;
+	~Tablebase ();
+	Tablebase (const Tablebase&) = delete;
+	Tablebase& operator= (const Tablebase&) = delete;
+
+	/* Map a tablebase file, reporting any error to clog */
+	bool open (const std::string& path);
+
+	uint64_t size () const { return header_->count; }
+	unsigned int bits () const { return header_->bits; }
+
+	/* Return the index of state in 0..size()-1, or size() if the state
+	fell through every level */
+	uint64_t index (const State& state) const;
+
+	Advice lookup (State state) const;
+
+private:
+	bool bit (uint64_t pos) const { return (bits_[pos >> 6] >> (pos & 63)) & 1; }
+
+	void *map_ = nullptr;
+	size_t map_size_ = 0;
+	const TablebaseHeader *header_ = nullptr;
+	const uint64_t *bits_ = nullptr;
+	const uint64_t *ranks_ = nullptr;
+	const uint64_t *values_ = nullptr;
+};
+
+} // namespace pyl
+
+#endif /* __PYL_TABLEBASE_H */
@@ -0,0 +1,75 @@
+
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+
+#include "pyl_trace.hpp"
+
+namespace pyl {
+
+void TraceBuffer::record (TraceType type, const State& state, int depth, int arg, const Prob *payoff)
+{
+	TraceEvent& e = events[next & (Capacity - 1)];
+	e.seq = next++;
+	e.type = type;
+	e.arg = arg;
+	e.depth = depth;
+	memcpy (e.state, &state, sizeof(e.state));
+	if (payoff)
+		memcpy (e.payoff, payoff, sizeof(e.payoff));
+	else
+		memset (e.payoff, 0, sizeof(e.payoff));
+}
+
+void TraceBuffer::write (std::ostream& os) const
+{
+	uint32_t count = next < Capacity ? next : Capacity;
+	uint32_t header[3] = { trace_magic, sizeof(TraceEvent), count };
+	os.write (reinterpret_cast<const char *> (header), sizeof(header));
+
+	for (uint32_t n = next - count; n != next; ++n)
+		os.write (reinterpret_cast<const char *> (&events[n & (Capacity - 1)]), sizeof(TraceEvent));
+}
+
+/**
+ * Write the buffer to the file named by the PYL_TRACE environment
+ * variable, or pyl.trace by default, and empty it, so that the next
+ * search's trace does not include the tail of this one.
+ */
+void TraceBuffer::dump ()
+{
+	const char *path = getenv ("PYL_TRACE");
+	std::ofstream os (path ? path : "pyl.trace", std::ios::binary);
+	write (os);
+	next = 0;
+}
+
+/**
+ * Return the calling thread's buffer.  The buffers are large, so they are
+ * allocated on first use rather than as thread_local objects.
+ */
+TraceBuffer& TraceBuffer::local ()
+{
+	static thread_local std::unique_ptr<TraceBuffer> buffer;
+	if (!buffer)
+		buffer = std::make_unique<TraceBuffer> ();
+	return *buffer;
+}
+
+long read_trace_header (std::istream& is)
+{
+	uint32_t header[3];
+	if (!is.read (reinterpret_cast<char *> (header), sizeof(header)))
+		return -1;
+	if (header[0] != trace_magic || header[1] != sizeof(TraceEvent))
+		return -1;
+	return header[2];
+}
+
+bool read_trace_event (std::istream& is, TraceEvent& event)
+{
+	return bool(is.read (reinterpret_cast<char *> (&event), sizeof(event)));
+}
+
+} // namespace pyl
@@ -0,0 +1,95 @@
+#ifndef __PYL_TRACE_H
+#define __PYL_TRACE_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+#include "pyl.hpp"
+
+/* Trace level, set at build time with TRACE=n.  At level 0 every trace
+call compiles to nothing. */
+#ifndef PYL_TRACE_LEVEL
+#define PYL_TRACE_LEVEL 0
+#endif
+
+namespace pyl {
+
+constexpr int trace_level = PYL_TRACE_LEVEL;
+
+enum TraceLevel
+{
+	TRACE_SEARCH = 1, /* per search and per deepening iteration */
+	TRACE_NODE = 2,   /* node creation and scanning */
+	TRACE_PAYOFF = 3, /* every decision made while computing payoffs */
+};
+
+enum TraceType : uint8_t
+{
+	TRACE_RUN,      /* Search::run started; state is the root */
+	TRACE_DEPTH,    /* deepening iteration done; arg is 1 once solved */
+	TRACE_CREATED,  /* node created; arg is the node kind */
+	TRACE_SCANNED,  /* node scanned; depth is the remaining depth */
+	TRACE_DECIDED,  /* decide node payoff computed; arg is the decision */
+};
+
+/* Node kinds, for TRACE_CREATED */
+enum TraceNodeKind : uint8_t { TRACE_TERMINAL, TRACE_DECIDE, TRACE_SPIN };
+
+/*
+ * TraceEvent - one fixed-size binary trace record.  The state is stored
+ * packed, exactly as in memory, and the payoff (when there is one) as
+ * raw probabilities.
+ */
+struct TraceEvent
+{
+	uint32_t seq;
+	uint8_t type;
+	uint8_t arg;
+	uint16_t depth;
+	uint32_t state[3];
+	float payoff[3];
+};
+static_assert (sizeof(TraceEvent) == 32, "TraceEvent should be 32 bytes");
+static_assert (sizeof(State) == sizeof(TraceEvent::state), "State does not fit a TraceEvent");
+
+/*
+ * TraceBuffer - per-thread ring buffer of trace events.  Once full, the
+ * oldest events are overwritten.
+ */
+struct TraceBuffer
+{
+	static constexpr uint32_t Capacity = 1 << 16;
+
+	TraceEvent events[Capacity];
+	uint32_t next = 0;
+
+	void record (TraceType type, const State& state, int depth, int arg, const Prob *payoff);
+
+	/* Write the buffered events, oldest first, in the trace file format:
+	a header of magic, event size and event count, then the events. */
+	void write (std::ostream& os) const;
+	void dump ();
+
+	static TraceBuffer& local ();
+};
+
+static constexpr uint32_t trace_magic = 0x544c5950; /* "PYLT" */
+
+/* Read one event from a trace file, as written by TraceBuffer::write.
+read_trace_header returns the number of events that follow, or -1 if
+this is not a trace file. */
+long read_trace_header (std::istream& is);
+bool read_trace_event (std::istream& is, TraceEvent& event);
+
+template <int Level>
+inline void trace (TraceType type, const State& state, int depth = 0, int arg = 0,
+	const Prob *payoff = nullptr)
+{
+	if constexpr (Level <= trace_level)
+		TraceBuffer::local ().record (type, state, depth, arg, payoff);
+}
+
+} // namespace pyl
+
+#endif /* __PYL_TRACE_H */
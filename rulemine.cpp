@@ -0,0 +1,215 @@
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_results.hpp"
+#include "pyl_rules.hpp"
+
+using namespace pyl;
+
+/*
+ * Mine play or pass rules from solved decide states (pyl_rules.hpp).
+ *
+ * Usage: rulemine [-e spins] [-m max_score] [-t step] [-i results]
+ *                 [-n support] [-v rules] [-c] [file]
+ *   -e, -m, -t    the region of roots to solve for the corpus, as in
+ *                 tbgen; every decide node that a search solved with both
+ *                 choices is a sample
+ *   -i results    take the corpus from a binary results file instead:
+ *                 the solved roots, except those where the player up
+ *                 could not choose under the default options
+ *   -n support    keep the rules that cover at least support states of
+ *                 the corpus (default 10)
+ *   -v rules      check the rules in a file against the corpus instead of
+ *                 mining new ones
+ *   -c            solve every root of the region again with and without
+ *                 the rules, and compare the nodes, the time and the
+ *                 decisions of the roots solved both ways
+ *
+ * The mined rules are written to file.
+ */
+
+/* Start a new search once the node cache is this large */
+constexpr size_t max_cache_nodes = 2000000;
+
+std::vector<State> region (unsigned int max_spins, unsigned int max_score, unsigned int step)
+{
+	std::vector<State> roots;
+	for (unsigned int spins = 1; spins <= max_spins; ++spins)
+		for (unsigned int up = 0; up <= max_score; up += step)
+			for (unsigned int leader = 0; leader <= max_score; leader += step)
+				roots.push_back (State{ {{0}, { up, spins }, { leader, 0 }} });
+	return roots;
+}
+
+void solve_region (const std::vector<State>& roots, std::vector<RuleSample>& samples)
+{
+	SearchOptions options;
+	/* Keep the decide nodes below settled ones, which are samples too */
+	options.freeze = false;
+	std::unique_ptr<Search> search;
+	for (const auto& root : roots)
+	{
+		/* Take the samples once per search, as the cache keeps the nodes
+		that every root solved so far */
+		if (search && search->node_cache_->size () > max_cache_nodes)
+			add_samples (*search, samples);
+		if (!search || search->node_cache_->size () > max_cache_nodes)
+			search = std::make_unique<Search> (SpinFeb85 (), options);
+		search->run (root);
+	}
+	if (search)
+		add_samples (*search, samples);
+}
+
+bool read_corpus (const std::string& path, std::vector<RuleSample>& samples)
+{
+	std::vector<ResultRecord> records;
+	if (!read_results (path, records))
+		return false;
+	SearchOptions options;
+	for (const auto& record : records)
+	{
+		if (!record.solved || record.decision == DecideNode::UNDECIDED)
+			continue;
+		State state;
+		memcpy (&state, record.state, sizeof(state));
+		state.change_player ();
+		if ((options.max_lead && state.lead() > options.max_lead) ||
+			(options.always_spin_third_place && state.third_place()))
+			continue;
+		samples.push_back (RuleSample{ state, DecideNode::Decision (record.decision) });
+	}
+	return true;
+}
+
+/* Solve each root in a fresh search, and return the decisions, or
+UNDECIDED where the search did not solve the root */
+std::vector<DecideNode::Decision> solve_each (const std::vector<State>& roots,
+	const SearchOptions& options, size_t& nodes, double& seconds)
+{
+	std::vector<DecideNode::Decision> decisions;
+	nodes = 0;
+	auto start = std::chrono::steady_clock::now ();
+	for (const auto& root : roots)
+	{
+		Search search (SpinFeb85 (), options);
+		const DecideNode *node = search.run (root);
+		SearchResult result;
+		decisions.push_back (node->solved (result, options) ? node->decision () : DecideNode::UNDECIDED);
+		nodes += search.node_cache_->size ();
+	}
+	seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	return decisions;
+}
+
+int main (int argc, char *argv[])
+{
+	unsigned int max_spins = 2;
+	unsigned int max_score = 10000;
+	unsigned int step = 1000;
+	unsigned int min_support = 10;
+	const char *results = nullptr;
+	const char *verify = nullptr;
+	bool compare = false;
+	int opt;
+	while ((opt = getopt (argc, argv, "e:m:t:i:n:v:c")) != -1)
+	{
+		switch (opt)
+		{
+			case 'e': max_spins = atoi (optarg); break;
+			case 'm': max_score = atoi (optarg); break;
+			case 't': step = atoi (optarg); break;
+			case 'i': results = optarg; break;
+			case 'n': min_support = atoi (optarg); break;
+			case 'v': verify = optarg; break;
+			case 'c': compare = true; break;
+			default:
+				optind = argc + 1;
+				break;
+		}
+	}
+	if (optind != argc - (verify ? 0 : 1) || step == 0)
+	{
+		cerr << "usage: " << argv[0] << " [-e spins] [-m max_score] [-t step] [-i results] "
+			"[-n support] [-v rules] [-c] [file]\n";
+		return 2;
+	}
+
+	/* Silence the search's progress report */
+	std::ostringstream chatter;
+	std::streambuf *clog_buf = clog.rdbuf (chatter.rdbuf ());
+
+	std::vector<State> roots = region (max_spins, max_score, step);
+	std::vector<RuleSample> samples;
+	auto start = std::chrono::steady_clock::now ();
+	bool ok = true;
+	if (results)
+		ok = read_corpus (results, samples);
+	else
+		solve_region (roots, samples);
+	clog.rdbuf (clog_buf);
+	if (!ok)
+	{
+		cerr << chatter.str ();
+		return 1;
+	}
+	double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	cout << samples.size () << " samples in " << seconds << " s\n";
+
+	MoveRules rules;
+	if (verify)
+	{
+		if (!rules.read (verify))
+			return 1;
+	}
+	else
+	{
+		rules = mine_rules (samples, min_support);
+		if (!rules.write (argv[optind]))
+			return 1;
+	}
+
+	size_t matched, wrong;
+	verify_rules (rules, samples, matched, wrong);
+	size_t plays = 0;
+	for (const auto& rule : rules.rules ())
+		plays += rule.decision == DecideNode::PLAY;
+	cout << rules.size () << " rules (" << plays << " play, " << rules.size () - plays << " pass) cover " <<
+		matched << " samples, " << wrong << " disagree\n";
+
+	if (compare)
+	{
+		SearchOptions options;
+		size_t plain_nodes, ruled_nodes;
+		double plain_seconds, ruled_seconds;
+		clog.rdbuf (chatter.rdbuf ());
+		auto plain = solve_each (roots, options, plain_nodes, plain_seconds);
+		options.move_rules = &rules;
+		auto ruled = solve_each (roots, options, ruled_nodes, ruled_seconds);
+		clog.rdbuf (clog_buf);
+		size_t changed = 0, unsolved = 0;
+		for (size_t n = 0; n < roots.size (); ++n)
+		{
+			if (plain[n] == DecideNode::UNDECIDED || ruled[n] == DecideNode::UNDECIDED)
+				unsolved++;
+			else
+				changed += plain[n] != ruled[n];
+		}
+		cout << roots.size () << " roots: " << plain_nodes << " nodes in " << plain_seconds << " s without rules, " <<
+			ruled_nodes << " nodes in " << ruled_seconds << " s with them\n" <<
+			"   " << changed << " decisions changed, " << unsolved << " roots not solved both ways\n";
+		if (changed)
+			return 1;
+	}
+	return wrong ? 1 : 0;
+}
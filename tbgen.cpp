@@ -0,0 +1,171 @@
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_board.hpp"
+#include "pyl_tablebase.hpp"
+#include "pyl_schedule.hpp"
+
+using namespace pyl;
+
+/*
+ * Generate a decision tablebase.
+ *
+ * Usage: tbgen [-f board] [-e spins] [-m max_score] [-t step] [-b bits] [-r] [-s] file
+ *   -f board      read the board from a text board file rather than using
+ *                 the February 1985 board; its powers are kept in a cache
+ *                 file in the current directory
+ *   -e spins      solve roots where the player up has 1 to spins earned
+ *                 spins (default 2)
+ *   -m max_score  scores of the player up and the leader range from 0 to
+ *                 max_score (default 10000) ...
+ *   -t step       ... in steps of step (default 1000)
+ *   -b bits       bits per state, 1 to 4 (default 2)
+ *   -r            store the roots only; by default, every decide node
+ *                 that a search solved is stored as well
+ *   -s            solve the roots in the order of a QueryScheduler, for
+ *                 reuse of the node cache, rather than by spins and score
+ *
+ * The file is then read back, every stored state is checked, and the
+ * lookup time is measured.
+ */
+
+/* Start a new search once the node cache is this large */
+constexpr size_t max_cache_nodes = 2000000;
+
+int main (int argc, char *argv[])
+{
+	const char *board_path = nullptr;
+	unsigned int max_spins = 2;
+	unsigned int max_score = 10000;
+	unsigned int step = 1000;
+	unsigned int bits = 2;
+	bool roots_only = false;
+	bool schedule = false;
+	int opt;
+	while ((opt = getopt (argc, argv, "f:e:m:t:b:rs")) != -1)
+	{
+		switch (opt)
+		{
+			case 'f': board_path = optarg; break;
+			case 'e': max_spins = atoi (optarg); break;
+			case 'm': max_score = atoi (optarg); break;
+			case 't': step = atoi (optarg); break;
+			case 'b': bits = atoi (optarg); break;
+			case 'r': roots_only = true; break;
+			case 's': schedule = true; break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1 || bits < 1 || bits > 4 || step == 0)
+	{
+		cerr << "usage: " << argv[0] << " [-f board] [-e spins] [-m max_score] [-t step] [-b bits] [-r] [-s] file\n";
+		return 2;
+	}
+	const char *path = argv[optind];
+
+	SpinPowers powers;
+	if (board_path)
+	{
+		TextBoard text;
+		if (!text.load (board_path))
+			return 2;
+		powers.cached (text, ".");
+	}
+	else
+		powers.compute (SpinFeb85 ());
+
+	/* Silence the search's progress report */
+	std::ostringstream chatter;
+	std::streambuf *clog_buf = clog.rdbuf (chatter.rdbuf ());
+
+	SearchOptions options;
+	/* Keep the graph below settled nodes, whose decide nodes are stored too */
+	options.freeze = roots_only;
+	std::unique_ptr<Search> search;
+	TablebaseWriter writer (bits);
+	QueryScheduler batch;
+	for (unsigned int spins = 1; spins <= max_spins; ++spins)
+		for (unsigned int up = 0; up <= max_score; up += step)
+			for (unsigned int leader = 0; leader <= max_score; leader += step)
+				batch.add (State{ {{0}, { up, spins }, { leader, 0 }} });
+
+	size_t roots = 0;
+	size_t nodes = 0;
+	auto start = std::chrono::steady_clock::now ();
+	for (size_t n = 0; n < batch.size (); ++n)
+	{
+		if (!search || search->node_cache_->size () > max_cache_nodes)
+		{
+			if (search)
+				nodes += search->node_cache_->size ();
+			search = std::make_unique<Search> (powers, options);
+		}
+		State init = batch.root (schedule ? batch.next (*search) : n);
+		DecideNode *root = search->run (init);
+		chatter.str ("");
+		roots++;
+
+		if (roots_only)
+			writer.add_solved (root, options);
+		else
+			writer.add_solved (*search);
+	}
+	nodes += search ? search->node_cache_->size () : 0;
+	search.reset ();
+	clog.rdbuf (clog_buf);
+	double seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+	cout << roots << " roots solved in " << seconds << " s, " << nodes << " nodes, " <<
+		writer.size () << " states\n";
+
+	if (!writer.write (path))
+		return 1;
+
+	Tablebase table;
+	if (!table.open (path))
+		return 1;
+
+	std::vector<State> states;
+	size_t wrong = 0;
+	for (const auto& entry : writer.entries ())
+	{
+		Advice advice = table.lookup (entry.first);
+		if (advice.decision != ((entry.second & 1) ? DecideNode::PASS : DecideNode::PLAY) ||
+			advice.confidence != unsigned(entry.second >> 1))
+			wrong++;
+		states.push_back (entry.first);
+	}
+
+	const int reps = 10;
+	unsigned int passes = 0;
+	start = std::chrono::steady_clock::now ();
+	for (int r = 0; r < reps; ++r)
+		for (const State& s : states)
+			passes += (table.lookup (s).decision == DecideNode::PASS);
+	seconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - start).count ();
+
+	size_t bytes = sizeof(TablebaseHeader);
+	{
+		std::ifstream is (path, std::ios::binary | std::ios::ate);
+		bytes = is.tellg ();
+	}
+	cout << path << ": " << table.size () << " states, " << bytes << " bytes (" <<
+		bytes * 8.0 / std::max<uint64_t> (1, table.size ()) << " bits per state), " <<
+		passes / reps << " pass\n";
+	cout << wrong << " wrong, " << seconds * 1e9 / std::max<size_t> (1, states.size () * reps) <<
+		" ns per lookup\n";
+	cout << "pages: ";
+	PageHeap::print (cout);
+	cout << '\n';
+	return wrong ? 1 : 0;
+}
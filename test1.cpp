@@ -68,6 +68,12 @@ int main (int argc, char *argv[])
 	run_search (board, State{ {{0}, { 1000, 10, 0, 3}, { 0, 0, 0, 3 }} });
 	run_search (board, State{ {{0}, { 10000, 2}, { 7000, 1 }} });
 	run_search (board, State{ {{0}, { 10000, 1}, { 7000, 0 }} });
+
+	/* PageHeap is shared by every search in the process, so its use is
+	reported once, at the end */
+	clog << "pages: ";
+	PageHeap::print (clog);
+	clog << '\n';
 	return 0;
 
 	//run_search (board, State{ {{0}, { 3000, 5}, { 6000, 4 }} }); // too many spins
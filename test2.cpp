@@ -1,9 +1,11 @@
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <memory>
 
 #include "pyl.hpp"
 #include "pyl_search.hpp"
+#include "pyl_results.hpp"
 
 using namespace pyl;
 
@@ -15,11 +17,19 @@ int main (int argc, char *argv[])
 	options.max_uncertainty = 0.01;
 	Search search (board, options);
 
+	/* Also stream the results to the file given, as CSV if it ends in .csv */
+	std::unique_ptr<ResultSink> results;
+	if (argc > 1)
+	{
+		results.reset (new ResultSink (argv[1], result_format (argv[1])));
+		search.results (results.get ());
+	}
+
 	const int min = 6000;
-	unsigned int lead;
+	int lead;
 	for (lead = -5000; lead <= 5000; lead += 250)
 	{
-		State s{ {{0}, { min+lead, 1}, { min, 0 }} };
+		State s{ {{0}, { unsigned (min+lead), 1}, { min, 0 }} };
 		DecideNode *node = search.run(s);
 		DecideNode::Decision decision = node->decision();
 		Node *play_node = node->if_play;
@@ -1,9 +1,11 @@
 #include <iostream>
 #include <iomanip>
 #include <cassert>
+#include <memory>
 
 #include "pyl.hpp"
 #include "pyl_search.hpp"
+#include "pyl_results.hpp"
 
 using namespace pyl;
 
@@ -15,6 +17,14 @@ int main (int argc, char *argv[])
 	options.max_uncertainty = 0.01;
 	Search search (board, options);
 
+	/* Also stream the results to the file given, as CSV if it ends in .csv */
+	std::unique_ptr<ResultSink> results;
+	if (argc > 1)
+	{
+		results.reset (new ResultSink (argv[1], result_format (argv[1])));
+		search.results (results.get ());
+	}
+
 	unsigned int spins;
 	for (spins = 1; spins <= 12; ++spins)
 	{
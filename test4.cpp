@@ -0,0 +1,395 @@
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unistd.h>
+
+#include "pyl.hpp"
+#include "pyl_search.hpp"
+#include "pyl_batch.hpp"
+#include "pyl_board.hpp"
+#include "pyl_table.hpp"
+#include "pyl_checkpoint.hpp"
+#include "pyl_results.hpp"
+#include "pyl_rules.hpp"
+#include "pyl_schedule.hpp"
+
+using namespace pyl;
+
+/*
+ * Solve the same roots under several variants of the February 1985 board
+ * at once, varying the weight of the Pick-a-Corner and Move One spaces.
+ * Then follow board changes within a single search, and check each
+ * re-solve against a cold search of the new board.  Also check that the
+ * text form of the board, the power cache and the powers composed at compile
+ * time agree with the board built at run time, and that a search resumed
+ * from a checkpoint or compacted between iterations ends where a plain one
+ * does, and that results streamed to a file read back as they were solved.
+ * Finally, mine move rules from a few solved roots, and check that a search
+ * pruned by them makes the same decisions with fewer nodes on other roots,
+ * and that the query scheduler orders roots for reuse of the node cache,
+ * while the roots of earlier runs stay valid.
+ */
+
+/* The first lane must match a single-board sweep over the same graph bit
+for bit.  So must every other lane match a single-board search that builds
+the same graph and is then switched to that lane's board. */
+void run_batch (BoardBatch& batch, const SpinOperator boards[], const SearchOptions& options, State init)
+{
+	std::vector<SearchResult> results = batch.run (init);
+	for (size_t b = 0; b < results.size (); ++b)
+		clog << "   board " << b << ": play " << results[b].play_win <<
+			" pass " << results[b].pass_win << '\n';
+
+	DecideNode *root = batch.root ();
+	PayoffSweep single;
+	single.compile (root);
+	single.evaluate ();
+	for (const Node *child : { root->if_play, root->if_pass })
+	{
+		if (!child)
+			continue;
+		const Payoff& expected = single.values[single.find (child)];
+		Payoff lane = batch.lane (batch.sweep ().find (child), 0);
+		for (int p = 0; p < num_players; ++p)
+			assert (lane[p] == expected[p]);
+	}
+
+	/* The batch does not freeze, so that the graph is the same */
+	SearchOptions unfrozen = options;
+	unfrozen.freeze = false;
+	for (size_t b = 1; b < results.size (); ++b)
+	{
+		Search search (boards[0], unfrozen);
+		search.run (init);
+		search.update_board (boards[b]);
+		const DecideNode *node = search.resolve (init);
+		const Node *expected[] = { node->if_play, node->if_pass };
+		const Node *children[] = { root->if_play, root->if_pass };
+		for (int c = 0; c < 2; ++c)
+		{
+			assert (!expected[c] == !children[c]);
+			if (!children[c])
+				continue;
+			Payoff lane = batch.lane (batch.sweep ().find (children[c]), b);
+			for (int p = 0; p < num_players; ++p)
+				assert (lane[p] == expected[c]->payoff ()[p]);
+		}
+	}
+	clog << "batch lanes match single-board searches\n";
+}
+
+void test_text_board ()
+{
+	TextBoard text;
+	bool loaded = text.load ("boards/feb85.board");
+	assert (loaded && text == SpinFeb85 ());
+
+	/* The first call writes the cache file, the second reads it */
+	SpinPowers written, cached, computed;
+	written.cached (text, ".");
+	cached.cached (text, ".");
+	computed.compute (SpinFeb85 ());
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+		assert (cached.op[n] == computed.op[n]);
+	clog << "text board " << std::hex << board_hash (text) << std::dec << " matches\n";
+
+	std::ostringstream path;
+	path << std::hex << std::setw(16) << std::setfill('0') << board_hash (text) << ".pow";
+	unlink (path.str().c_str());
+}
+
+/* Same outcomes, and probabilities equal up to rounding */
+bool close (const SpinOperator& a, const SpinOperator& b)
+{
+	if (a.expr.size () != b.expr.size ())
+		return false;
+	for (const auto& term : a.expr.terms)
+	{
+		auto it = b.expr.terms.find (term.first);
+		if (it == b.expr.terms.end () || std::fabs (term.second - it->second) > 1e-6)
+			return false;
+	}
+	return true;
+}
+
+void test_static_board ()
+{
+	/* The number of outcomes depends on SCORE_UNIT, which may merge scores */
+	assert (feb85_table.size () == SpinFeb85 ().expr.size ());
+	SpinPowers computed, compiled;
+	computed.compute (SpinFeb85 ());
+	compiled.assign<feb85_table> ();
+	for (int n = 0; n < Search::MaxPassedSpins; ++n)
+		assert (close (computed.op[n], compiled.op[n]));
+	clog << "compile-time powers match, " << SpinPower<feb85_table, 6>::table.size () << " terms in power 6\n";
+}
+
+/* Checkpoint a search after every iteration, then resume a new search from
+the last checkpoint.  Both must reach the same result.  The nodes frozen
+before the checkpoint stay frozen, and a board update must still thaw
+them, so that the re-solve agrees with a cold search of the new board. */
+void test_checkpoint (const SearchOptions& options, State init)
+{
+	const char *path = "test4.checkpoint";
+	SearchResult full;
+	{
+		Search search (SpinFeb85 (), options);
+		search.checkpoint (path, 0);
+		search.run (init);
+		full = search.result ();
+	}
+	Search resumed (SpinFeb85 (), options);
+	bool loaded = resumed.resume (path);
+	assert (loaded);
+	size_t frozen = 0;
+	resumed.node_cache_->apply ([&frozen] (Node *node) { frozen += node->frozen (); });
+	assert (frozen > 0);
+	resumed.run (init);
+	SearchResult result = resumed.result ();
+	assert (result.play_win.min () == full.play_win.min () && result.play_win.max () == full.play_win.max ());
+	assert (result.pass_win.min () == full.pass_win.min () && result.pass_win.max () == full.pass_win.max ());
+	clog << "resumed search matches, " << frozen << " nodes frozen\n";
+	unlink (path);
+
+	SpinOperator board = SpinFeb85 (0.0, SpinFeb85::B2, 0.0);
+	resumed.update_board (board);
+	DecideNode::Decision decision = resumed.resolve (init)->decision ();
+	Search cold (board, options);
+	assert (decision == cold.run (init)->decision ());
+	result = resumed.result ();
+	assert (result.play_win.overlaps (cold.result ().play_win));
+	assert (result.pass_win.overlaps (cold.result ().pass_win));
+	clog << "resumed re-solve matches a cold search\n";
+}
+
+/* Compacting the nodes between iterations must not change the result */
+void test_compact (SearchOptions options, State init)
+{
+	Search plain (SpinFeb85 (), options);
+	plain.run (init);
+	options.compact = COMPACT_PREORDER;
+	Search compacted (SpinFeb85 (), options);
+	compacted.run (init);
+	const SearchResult& a = plain.result ();
+	const SearchResult& b = compacted.result ();
+	assert (a.play_win.min () == b.play_win.min () && a.play_win.max () == b.play_win.max ());
+	assert (a.pass_win.min () == b.pass_win.min () && a.pass_win.max () == b.pass_win.max ());
+	assert (plain.node_cache_->size () == compacted.node_cache_->size ());
+	clog << "compacted search matches\n";
+}
+
+void test_results (const SearchOptions& options)
+{
+	const char *path = "test4.results";
+	const State roots[] = {
+		State{ {{0}, { 10000, 1}, { 7000, 0 }} },
+		State{ {{0}, { 8000, 1}, { 3000, 0 }} },
+	};
+	std::vector<DecideNode::Decision> decisions;
+	std::vector<size_t> nodes;
+	{
+		ResultSink sink (path, RESULTS_BINARY);
+		for (const auto& root : roots)
+		{
+			Search search (SpinFeb85 (), options);
+			search.results (&sink);
+			DecideNode *node = search.run (root);
+			decisions.push_back (node->decision ());
+			nodes.push_back (search.node_cache_->size ());
+		}
+	}
+	std::vector<ResultRecord> records;
+	bool loaded = read_results (path, records);
+	assert (loaded && records.size () == decisions.size ());
+	for (size_t n = 0; n < records.size (); ++n)
+	{
+		assert (memcmp (records[n].state, &roots[n], sizeof(State)) == 0);
+		assert (records[n].decision == decisions[n] && records[n].nodes == nodes[n]);
+	}
+	clog << "streamed results match\n";
+	unlink (path);
+}
+
+/* Mine rules from one set of roots and test them on roots between those,
+which the rules were not mined from, as rulemine -v does.  Rules prune
+below the root only, so the root's own choice is always searched. */
+void test_rules (const SearchOptions& options)
+{
+	std::vector<State> roots, held_out;
+	for (unsigned int up = 0; up <= 10000; up += 2000)
+		for (unsigned int leader = 0; leader <= 10000; leader += 2000)
+		{
+			roots.push_back (State{ {{0}, { up, 1 }, { leader, 0 }} });
+			if (up < 10000 && leader < 10000)
+				held_out.push_back (State{ {{0}, { up + 1000, 1 }, { leader + 1000, 0 }} });
+		}
+
+	std::vector<RuleSample> samples;
+	{
+		Search search (SpinFeb85 (), options);
+		for (const auto& root : roots)
+			search.run (root);
+		add_samples (search, samples);
+	}
+	MoveRules rules = mine_rules (samples, 10);
+	size_t matched, wrong;
+	verify_rules (rules, samples, matched, wrong);
+	assert (rules.size () > 0 && matched > 0 && wrong == 0);
+
+	SearchOptions pruned = options;
+	pruned.move_rules = &rules;
+	size_t ruled_roots = 0, plain_nodes = 0, ruled_nodes = 0;
+	for (const auto& root : held_out)
+	{
+		Search plain (SpinFeb85 (), options);
+		Search ruled (SpinFeb85 (), pruned);
+		SearchResult result;
+		const DecideNode *a = plain.run (root);
+		const DecideNode *b = ruled.run (root);
+		ruled_roots += (b->ruled (pruned) != DecideNode::UNDECIDED);
+		assert (bool(a->if_play) == bool(b->if_play) && bool(a->if_pass) == bool(b->if_pass));
+		if (a->solved (result, options) && b->solved (result, pruned))
+			assert (a->decision () == b->decision ());
+		assert (ruled.node_cache_->size () <= plain.node_cache_->size ());
+		plain_nodes += plain.node_cache_->size ();
+		ruled_nodes += ruled.node_cache_->size ();
+	}
+	assert (ruled_roots > 0 && ruled_nodes < plain_nodes);
+	clog << rules.size () << " mined rules keep the decisions on " << held_out.size () <<
+		" held-out roots, " << ruled_roots << " of them covered\n";
+}
+
+/* The scheduler starts nearest the end of the game, then prefers a root
+whose decide node an earlier search left in the cache over a nearer one
+that is not there */
+void test_schedule (const SearchOptions& options)
+{
+	const State first{ {{0}, { 8000, 1}, { 3000, 0 }} };
+	const State cached{ {{0}, { 4500, 2}, { 3000, 0 }} };
+	const State nearer{ {{0}, { 8000, 2}, { 3500, 0 }} };
+	QueryScheduler batch;
+	batch.add (State{ {{0}, { 2000, 1}, { 3000, 0 }} });
+	batch.add (cached);
+	batch.add (first);
+	batch.add (nearer);
+
+	Search search (SpinFeb85 (), options);
+	assert (batch.root (batch.next (search)) == first);
+	search.run (first);
+	/* A search that passes through the cached root */
+	search.run (State{ {{0}, { 4000, 3}, { 3000, 0 }} });
+
+	auto in_cache = [&search] (State root) {
+		root.change_player ();
+		return search.node_cache_->find (root, NODE_DECIDE) != nullptr;
+	};
+	assert (in_cache (cached) && !in_cache (nearer));
+	assert (QueryScheduler::distance (first, nearer) < QueryScheduler::distance (first, cached));
+	assert (batch.root (batch.next (search)) == cached);
+	clog << "scheduler prefers cached roots\n";
+}
+
+/* A root solved earlier in the same search stays in the cache, at the same
+address, when later runs reach it as a child and freeze every node that
+links to it, or compact the nodes.  With compaction, a root that an
+earlier compaction moved is also run, so that pinning moves it out of the
+compacted block first. */
+void test_pinned_roots (const SearchOptions& options)
+{
+	State earlier{ {{0}, { 8000, 1}, { 3000, 0 }} };
+	Search search (SpinFeb85 (), options);
+	const DecideNode *node = search.run (earlier);
+	DecideNode::Decision decision = node->decision ();
+	const DecideNode *inner = nullptr;
+	DecideNode::Decision inner_decision = DecideNode::UNDECIDED;
+	for (unsigned int n = 1; n <= 4; ++n)
+	{
+		search.run (State{ {{0}, { 8000 - 1000 * n, 1 + n }, { 3000, 0 }} });
+		if (options.compact && !inner)
+		{
+			/* Any decide node that is not a root, run as a root of its own */
+			search.node_cache_->apply ([&inner] (Node *child) {
+				if (!inner && child->kind () == NODE_DECIDE && !child->pinned () && child->linked ())
+					inner = static_cast<const DecideNode *> (child);
+			});
+			State state = inner->state;
+			inner = search.run (state);
+			inner_decision = inner->decision ();
+		}
+	}
+	earlier.change_player ();
+	assert (search.node_cache_->find (earlier, NODE_DECIDE) == node);
+	assert (node->decision () == decision);
+	if (inner)
+	{
+		assert (search.node_cache_->find (inner->state, NODE_DECIDE) == inner);
+		assert (inner->decision () == inner_decision);
+	}
+	clog << "earlier roots stay pinned" << (options.compact ? " with compaction\n" : "\n");
+}
+
+int main (int argc, char *argv[])
+{
+	SearchOptions options; /* use defaults */
+	test_text_board ();
+	test_static_board ();
+	const SpinOperator batch_boards[] = {
+		SpinFeb85 (),
+		SpinFeb85 (0.0, SpinFeb85::B2, 0.0),
+		SpinFeb85 (2 * SpinFeb85::PC, SpinFeb85::B2, 2 * SpinFeb85::M1),
+		SpinFeb85 (SpinFeb85::PC, 0.0, SpinFeb85::M1, SpinFeb85::A2, 0.0),
+	};
+	BoardBatch batch (options);
+	for (const auto& board : batch_boards)
+		batch.add_board (board);
+
+	clog.setf (ios::fixed, ios::floatfield);
+	clog.precision (3);
+
+	test_checkpoint (options, State{ {{0}, { 10000, 3}, { 7000, 1 }} });
+	test_compact (options, State{ {{0}, { 8000, 2}, { 3000, 0 }} });
+	test_results (options);
+	test_rules (options);
+	test_schedule (options);
+	test_pinned_roots (options);
+	SearchOptions compact_options = options;
+	compact_options.compact = COMPACT_PREORDER;
+	test_pinned_roots (compact_options);
+
+	run_batch (batch, batch_boards, options, State{ {{0}, { 10000, 2}, { 7000, 1 }} });
+	run_batch (batch, batch_boards, options, State{ {{2000}, { 3000, 3}, { 6000 }} });
+
+	/* Change the board in the middle of a search, once keeping the same
+	outcomes and once with different ones.  Each re-solve must agree with a
+	cold search of the new board.  With the same outcomes, only probabilities
+	and payoffs change; with different ones, the spin nodes that reach other
+	states are also expanded again.  The times of the re-solve and of the
+	cold search are reported, not compared, as they depend on the load of
+	the machine. */
+	State init{ {{0}, { 10000, 2}, { 7000, 1 }} };
+	Search search (SpinFeb85 (), options);
+	search.run (init);
+	SpinOperator boards[] = { SpinFeb85 (0.0, SpinFeb85::B2, 0.0), SpinFeb85 ().spread () };
+	for (const auto& board : boards)
+	{
+		auto start = std::chrono::steady_clock::now ();
+		size_t changed = search.update_board (board);
+		clog << "\nBoard updated, " << changed << " spin nodes changed\n";
+		DecideNode::Decision decision = search.resolve (init)->decision ();
+		SearchResult result = search.result ();
+		auto resolved = std::chrono::steady_clock::now ();
+		Search cold (board, options);
+		assert (decision == cold.run (init)->decision ());
+		auto end = std::chrono::steady_clock::now ();
+		assert (result.play_win.overlaps (cold.result ().play_win));
+		assert (result.pass_win.overlaps (cold.result ().pass_win));
+		clog << "re-solve matches a cold search, " <<
+			std::chrono::duration<double> (resolved - start).count () << "s against " <<
+			std::chrono::duration<double> (end - resolved).count () << "s\n";
+	}
+	return 0;
+}
@@ -0,0 +1,65 @@
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstring>
+
+#include "pyl.hpp"
+#include "pyl_trace.hpp"
+
+using namespace pyl;
+
+/*
+ * Decode a binary trace file written by a build with TRACE=n.
+ *
+ * Usage: tracedump [file]    (default pyl.trace)
+ */
+
+const char *type_name[] = { "run", "depth", "created", "scanned", "decided" };
+const char *kind_name[] = { "terminal", "decide", "spin" };
+const char *decision_name[] = { "undecided", "play", "pass" };
+
+int main (int argc, char *argv[])
+{
+	const char *path = (argc > 1) ? argv[1] : "pyl.trace";
+	std::ifstream is (path, std::ios::binary);
+	long count = read_trace_header (is);
+	if (count < 0)
+	{
+		cerr << path << ": not a trace file\n";
+		return 1;
+	}
+
+	cout.setf (ios::fixed, ios::floatfield);
+	cout.precision (3);
+
+	TraceEvent e;
+	for (long n = 0; n < count && read_trace_event (is, e); ++n)
+	{
+		State state;
+		memcpy (&state, e.state, sizeof(state));
+
+		cout << std::setw(10) << e.seq << ' ' << std::left << std::setw(8) <<
+			(e.type <= TRACE_DECIDED ? type_name[e.type] : "?") << std::right;
+		switch (e.type)
+		{
+			case TRACE_DEPTH:
+				cout << " depth " << e.depth << (e.arg ? " solved" : "");
+				break;
+			case TRACE_SCANNED:
+				cout << " depth " << e.depth;
+				break;
+			case TRACE_CREATED:
+				cout << ' ' << (e.arg < 3 ? kind_name[e.arg] : "?");
+				break;
+			case TRACE_DECIDED:
+				cout << ' ' << (e.arg < 3 ? decision_name[e.arg] : "?");
+				break;
+		}
+		cout << ' ' << state;
+		if (e.type == TRACE_DEPTH || e.type == TRACE_DECIDED)
+			cout << " (" << e.payoff[0] << ' ' << e.payoff[1] << ' ' << e.payoff[2] << ')';
+		cout << '\n';
+	}
+	return 0;
+}